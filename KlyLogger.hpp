@@ -25,27 +25,45 @@
 */
 
 #pragma once
-#define _SILENCE_CXX17_CODECVT_HEADER_DEPRECATION_WARNING
 
 #ifndef KLY_LOGGER_INCLUDED
 #define KLY_LOGGER_INCLUDED
 
-#include <codecvt>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdint>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <functional>
 #include <iostream>
-#include <queue>
+#include <optional>
+#include <source_location>
+#include <string_view>
 #include <sys/stat.h>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
 
 using namespace std::chrono_literals;
 
 #ifdef _WIN32
 #include <Windows.h>
+#include <direct.h>
+#include <fcntl.h>
 #include <io.h>
+#include <process.h>
 #define isatty _isatty
 #define fileno _fileno
 
@@ -57,10 +75,32 @@ extern "C" int RtlGetVersion(PRTL_OSVERSIONINFOEXW) noexcept;
 #endif
 
 #else
+#include <climits>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #endif
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#ifdef KLY_LOGGER_OPTION_GZIP
+#include <zlib.h>
+#endif
+
+#if (defined(KLY_LOGGER_OPTION_MMAP_LOG_FILE) || defined(KLY_LOGGER_OPTION_SHARED_RING)) && !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+#include <pthread.h>
+#include <sys/file.h>
+#endif
+
 // Type traits for string conversion.
 template<typename T, typename = void>
 struct has_string : std::false_type {};
@@ -76,20 +116,263 @@ struct has_wstring<T, std::void_t<decltype(std::declval<T>().wstring())>> : std:
 #undef max
 #endif
 
+// Numeric log levels, used by KLY_LOGGER_OPTION_MIN_LEVEL.
+#define KLY_LOGGER_LEVEL_TRACE 0
+#define KLY_LOGGER_LEVEL_DEBUG 1
+#define KLY_LOGGER_LEVEL_INFO 2
+#define KLY_LOGGER_LEVEL_WARN 3
+#define KLY_LOGGER_LEVEL_ERROR 4
+#define KLY_LOGGER_LEVEL_FATAL 5
+#define KLY_LOGGER_LEVEL_OFF 6
+
+// Lowest log level compiled into the program, calls below it compile to nothing.
+#ifndef KLY_LOGGER_OPTION_MIN_LEVEL
+#define KLY_LOGGER_OPTION_MIN_LEVEL KLY_LOGGER_LEVEL_TRACE
+#endif
+
+// Number of log tasks the queue can hold before the overflow policy applies (must be a power of two).
+#ifndef KLY_LOGGER_OPTION_QUEUE_CAPACITY
+#define KLY_LOGGER_OPTION_QUEUE_CAPACITY 8192
+#endif
+
+// Upper bound of the adaptive busy-wait the logging thread performs before sleeping (0 disables spinning).
+#ifndef KLY_LOGGER_OPTION_SPIN_LIMIT
+#define KLY_LOGGER_OPTION_SPIN_LIMIT 4096
+#endif
+
+// Number of records the queue of a sink with its own writer thread can hold (must be a power of two).
+#ifndef KLY_LOGGER_OPTION_SINK_QUEUE_CAPACITY
+#define KLY_LOGGER_OPTION_SINK_QUEUE_CAPACITY 4096
+#endif
+
+// Size by which the memory-mapped log file grows (see KLY_LOGGER_OPTION_MMAP_LOG_FILE, must be a multiple of the page size).
+#ifndef KLY_LOGGER_OPTION_MMAP_SEGMENT_SIZE
+#define KLY_LOGGER_OPTION_MMAP_SEGMENT_SIZE (4 << 20)
+#endif
+
+// Number of most recent log calls the flight recorder keeps per thread (must be a power of two, see KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER).
+#ifndef KLY_LOGGER_OPTION_FLIGHT_RECORDER_SIZE
+#define KLY_LOGGER_OPTION_FLIGHT_RECORDER_SIZE 256
+#endif
+
+// Size in bytes of the ring shared by the processes of a logs directory (must be a power of two, see KLY_LOGGER_OPTION_SHARED_RING).
+#ifndef KLY_LOGGER_OPTION_SHARED_RING_SIZE
+#define KLY_LOGGER_OPTION_SHARED_RING_SIZE (4 << 20)
+#endif
+
 // KlyLogger: A lightweight, color console and file logging library for C++.
 class KlyLogger {
 public:
+#ifdef _WIN32
+	// Character type of formatted messages and console output, UTF-16 as required by the Windows console API.
+	using OutputChar = wchar_t;
+#else
+	// Character type of formatted messages and console output, UTF-8 so text reaches stderr and the log file unchanged.
+	using OutputChar = char;
+#endif
+	using OutputString = std::basic_string<OutputChar>;
+	using OutputView = std::basic_string_view<OutputChar>;
+
 	// String conversion utilities.
 	class StringConverter {
 	public:
-		// Cross-platform string encoding converter.
-		static inline std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		// Strings the arguments of the calls being formatted on this thread were converted into. They keep their capacity
+		// for the next call, so converting allocates nothing once warmed up, and a deque keeps references to them stable.
+		struct Scratch {
+			std::deque<OutputString> strings;
+			size_t used;
+		};
+
+		static inline thread_local Scratch scratch;
+
+		// Whether a type is a narrow string, a wide string, or a string in the output encoding.
+		template<typename T>
+		static constexpr bool isNarrowString = std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view> || std::is_convertible_v<T, const char *>;
+		template<typename T>
+		static constexpr bool isWideString = std::is_same_v<T, std::wstring> || std::is_same_v<T, std::wstring_view> || std::is_convertible_v<T, const wchar_t *>;
+		template<typename T>
+		static constexpr bool isOutputString = std::is_same_v<OutputChar, char> ? isNarrowString<T> : isWideString<T>;
+
+		// Message format marked with KlyLogger::literal(), which outlives the call, so captures of the call keep the pointer.
+		template<typename Char>
+		struct Literal {
+			const Char *text;
+		};
+
+		template<typename T>
+		static constexpr bool isLiteral = std::is_same_v<T, Literal<char>> || std::is_same_v<T, Literal<wchar_t>>;
+
+		// The message of a log call as it is captured. Only formats marked with KlyLogger::literal() are kept as literals,
+		// character arrays are copied like std::string since a constant array may as well live on the stack of the caller.
+		template<typename T>
+		static decltype(auto) messageOf(T &&message) noexcept {
+			if constexpr (isLiteral<std::remove_cvref_t<T>>) return std::remove_cvref_t<T>(message);
+			else return std::as_const(message);
+		}
+
+		// Number of characters the fast paths of the transcoder handle at once.
+		static constexpr size_t ASCII_BLOCK = 16;
+
+		// Copy the leading ASCII characters of wide text to `out` one block at a time, stopping at the first block
+		// that holds another character or is incomplete. Returns the number of characters copied.
+		static size_t narrowAscii(const wchar_t *str, size_t length, char *out) noexcept {
+			size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+			for (; i + ASCII_BLOCK <= length; i += ASCII_BLOCK) {
+				const auto *block = reinterpret_cast<const __m128i *>(str + i);
+				__m128i narrowed;
+				if constexpr (sizeof(wchar_t) == 4) {
+					const __m128i a = _mm_loadu_si128(block), b = _mm_loadu_si128(block + 1), c = _mm_loadu_si128(block + 2), d = _mm_loadu_si128(block + 3);
+					const __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), _mm_set1_epi32(~0x7F));
+					if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF) break;
+					narrowed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+				} else {
+					const __m128i a = _mm_loadu_si128(block), b = _mm_loadu_si128(block + 1);
+					const __m128i high = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xFF80)));
+					if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF) break;
+					narrowed = _mm_packus_epi16(a, b);
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), narrowed);
+			}
+#endif
+			return i;
+		}
+
+		// Copy the leading ASCII bytes of narrow text to `out` as wide characters one block at a time, stopping at the first
+		// block that holds another byte or is incomplete. Returns the number of bytes copied.
+		static size_t widenAscii(const char *str, size_t length, wchar_t *out) noexcept {
+			size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + ASCII_BLOCK <= length; i += ASCII_BLOCK) {
+				const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + i));
+				if (_mm_movemask_epi8(bytes)) break;
+				const __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+				auto *target = reinterpret_cast<__m128i *>(out + i);
+				if constexpr (sizeof(wchar_t) == 4) {
+					_mm_storeu_si128(target, _mm_unpacklo_epi16(low, zero));
+					_mm_storeu_si128(target + 1, _mm_unpackhi_epi16(low, zero));
+					_mm_storeu_si128(target + 2, _mm_unpacklo_epi16(high, zero));
+					_mm_storeu_si128(target + 3, _mm_unpackhi_epi16(high, zero));
+				} else {
+					_mm_storeu_si128(target, low);
+					_mm_storeu_si128(target + 1, high);
+				}
+			}
+#endif
+			return i;
+		}
+
+		// Append wide text as UTF-8, unpaired surrogates and invalid code points become U+FFFD.
+		// Runs of ASCII are converted a block at a time, other characters one by one up to the end of their block.
+		static void appendUtf8(std::string &out, std::wstring_view str) {
+			const size_t start = out.size();
+			out.resize(start + str.length() * (sizeof(wchar_t) == 2 ? 3 : 4));
+			char *next = out.data() + start;
+			const wchar_t *data = str.data();
+			const size_t length = str.length();
+			for (size_t i = 0; i < length;) {
+				const size_t ascii = narrowAscii(data + i, length - i, next);
+				i += ascii;
+				next += ascii;
+				for (const size_t blockEnd = std::min(length, i + ASCII_BLOCK); i < blockEnd; i++) {
+					auto c = static_cast<std::uint32_t>(data[i]);
+					if (c < 0x80) {
+						*next++ = static_cast<char>(c);
+						continue;
+					}
+
+					if (sizeof(wchar_t) == 2 && c >= 0xD800 && c <= 0xDBFF && i + 1 < length && (data[i + 1] & 0xFC00) == 0xDC00)
+						c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<std::uint32_t>(data[++i]) - 0xDC00);
+					else if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) c = 0xFFFD;
+
+					if (c < 0x800) *next++ = static_cast<char>(0xC0 | c >> 6);
+					else {
+						if (c < 0x10000) *next++ = static_cast<char>(0xE0 | c >> 12);
+						else {
+							*next++ = static_cast<char>(0xF0 | c >> 18);
+							*next++ = static_cast<char>(0x80 | (c >> 12 & 0x3F));
+						}
+						*next++ = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+					}
+					*next++ = static_cast<char>(0x80 | (c & 0x3F));
+				}
+			}
+			out.resize(static_cast<size_t>(next - out.data()));
+		}
+
+		// Decode the UTF-8 sequence starting at data[i], whose lead byte is not ASCII, and advance i past it.
+		// An invalid sequence (a stray continuation byte, truncated, overlong, a surrogate or out of range) becomes U+FFFD and clears `valid`.
+		static std::uint32_t decodeUtf8(const unsigned char *data, size_t length, size_t &i, bool &valid) noexcept {
+			std::uint32_t c = data[i];
+
+			// Sequence length from the lead byte, and the smallest code point it may encode (rejects overlong forms).
+			size_t count = 0;
+			std::uint32_t minimum = 0;
+			if ((c & 0xE0) == 0xC0) {
+				count = 2;
+				minimum = 0x80;
+				c &= 0x1F;
+			} else if ((c & 0xF0) == 0xE0) {
+				count = 3;
+				minimum = 0x800;
+				c &= 0x0F;
+			} else if ((c & 0xF8) == 0xF0) {
+				count = 4;
+				minimum = 0x10000;
+				c &= 0x07;
+			}
+
+			size_t n = 1;
+			while (n < count && i + n < length && (data[i + n] & 0xC0) == 0x80) c = c << 6 | (data[i + n++] & 0x3F);
+			i += n;
+			if (!count || n < count || c < minimum || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+				valid = false;
+				return 0xFFFD;
+			}
+			return c;
+		}
+
+		// Append UTF-8 text as wide text, returns false if it is not valid UTF-8 (invalid sequences become U+FFFD).
+		// Runs of ASCII are converted a block at a time, other characters one by one up to the end of their block.
+		static bool appendWide(std::wstring &out, std::string_view str) {
+			// Every byte becomes at most one wide character, except 4-byte sequences which become a surrogate pair in UTF-16.
+			const size_t start = out.size();
+			out.resize(start + str.length());
+			wchar_t *next = out.data() + start;
+			const auto *data = reinterpret_cast<const unsigned char *>(str.data());
+			const size_t length = str.length();
+			bool valid = true;
+			for (size_t i = 0; i < length;) {
+				const size_t ascii = widenAscii(str.data() + i, length - i, next);
+				i += ascii;
+				next += ascii;
+				for (const size_t blockEnd = std::min(length, i + ASCII_BLOCK); i < blockEnd;) {
+					std::uint32_t c = data[i];
+					if (c < 0x80) {
+						*next++ = static_cast<wchar_t>(c);
+						i++;
+						continue;
+					}
 
-		// Cache used when converting arguments for log tasks (prevents loss of converted data or incorrect log output).
-		static inline std::queue<std::wstring> converted;
+					c = decodeUtf8(data, length, i, valid);
+					if (sizeof(wchar_t) == 2 && c >= 0x10000) {
+						*next++ = static_cast<wchar_t>(0xD800 + ((c - 0x10000) >> 10));
+						*next++ = static_cast<wchar_t>(0xDC00 + ((c - 0x10000) & 0x3FF));
+					} else *next++ = static_cast<wchar_t>(c);
+				}
+			}
+			out.resize(static_cast<size_t>(next - out.data()));
+			return valid;
+		}
 
-		// Convert wide string to narrow string.
-		static std::string toString(const std::wstring &str) { return converter.to_bytes(str); }
+		// Convert wide string to narrow (UTF-8) string.
+		static std::string toString(std::wstring_view str) {
+			std::string result;
+			result.reserve(str.length());
+			appendUtf8(result, str);
+			return result;
+		}
 
 		// Convert narrow string to wide string safely.
 		static std::wstring toWString(const std::string &str) {
@@ -107,225 +390,1050 @@ public:
 				return result;
 			}
 #endif
-			try {
-				// Fallback: use std::wstring_convert to convert UTF-8 to wstring.
-				return converter.from_bytes(str);
-			} catch (const std::exception &e) {
-				// If conversion fails, handle exception:
-				// Return a fallback wide string: original characters plus an error message.
-				const auto &what = e.what();
-				return toWString(str.begin(), str.end()) + L"\2478\247o (decoder error: " + toWString(what, what + strlen(what)) + L')';
-			}
+			// Fallback: decode the string as UTF-8.
+			std::wstring result;
+			result.reserve(str.length());
+			if (appendWide(result, str)) return result;
+			// If decoding fails, return the original characters plus an error message.
+			return toWString(str.begin(), str.end()) + L"\2478\247o (decoder error: invalid UTF-8)";
 		}
 
 		// Convert narrow string to wide string directly.
 		static std::wstring toWString(const auto &from, const auto &to) { return std::wstring(from, to); }
 
-		// Helper to normalize different argument types into wide strings.
-		// Handles std::string, const char*, and custom types with string()/wstring().
+		// Convert text to the output encoding.
+		static OutputString toOutput(std::string_view str) {
+#ifdef _WIN32
+			return toWString(std::string(str));
+#else
+			return OutputString(str);
+#endif
+		}
+
+		// Convert wide text to the output encoding.
+		static OutputString toOutput(std::wstring_view str) {
+#ifdef _WIN32
+			return OutputString(str);
+#else
+			return toString(str);
+#endif
+		}
+
+		// Append text to text in the output encoding.
+		static void appendOutput(OutputString &out, std::string_view str) {
+#ifdef _WIN32
+			out += toWString(std::string(str));
+#else
+			out += str;
+#endif
+		}
+
+		// Append wide text to text in the output encoding.
+		static void appendOutput(OutputString &out, std::wstring_view str) {
+#ifdef _WIN32
+			out += str;
+#else
+			appendUtf8(out, str);
+#endif
+		}
+
+		// Convert output text to UTF-8, as written to the log file.
+		static std::string toUtf8(OutputView str) {
+#ifdef _WIN32
+			return toString(str);
+#else
+			return std::string(str);
+#endif
+		}
+
+		// Convert output text to a wide string, as passed to the after-log callback.
+		static std::wstring toWide(OutputView str) {
+#ifdef _WIN32
+			return std::wstring(str);
+#else
+			std::wstring result;
+			result.reserve(str.length());
+			appendWide(result, str);
+			return result;
+#endif
+		}
+
+		// Format a single value as text in the output encoding.
+		template<typename T>
+		static OutputString formatValue(const T &arg) {
+			if constexpr (std::is_same_v<OutputChar, char>) return std::format("{}", arg);
+			else return std::format(L"{}", arg);
+		}
+
+		// Take an empty scratch string for an argument being converted on this thread.
+		static OutputString &nextScratch() {
+			if (scratch.used == scratch.strings.size()) scratch.strings.emplace_back();
+			OutputString &text = scratch.strings[scratch.used++];
+			text.clear();
+			return text;
+		}
+
+		// Hands the scratch strings taken during a call back when it returns, so nested calls keep the ones of outer calls.
+		class ScratchScope {
+		public:
+			explicit ScratchScope() noexcept : mark(scratch.used) {}
+
+			~ScratchScope() {
+				// Strings grown by an unusually large argument are released rather than kept for every later call.
+				for (size_t i = mark; i < scratch.used; i++)
+					if (scratch.strings[i].capacity() > 65536) OutputString().swap(scratch.strings[i]);
+				scratch.used = mark;
+			}
+
+			ScratchScope(const ScratchScope &) = delete;
+			ScratchScope &operator=(const ScratchScope &) = delete;
+
+		private:
+			size_t mark;
+		};
+
+		// Helper to normalize different argument types into values formattable in the output encoding.
+		// Handles strings of the other character type and custom types with string()/wstring().
 		template<typename T>
 		static auto &convertFormatting(const T &arg) {
-			// If argument is a std::string or convertible to const char*,
-			// convert it to std::wstring and store.
-			if constexpr (std::is_same_v<T, std::string> || std::is_convertible_v<T, const char *>) {
-				converted.push(toWString(arg));
-				return converted.back();
+			// If argument is a string of the other character type, convert it to the output encoding in a scratch string.
+			if constexpr ((isNarrowString<T> || isWideString<T>) && !isOutputString<T>) {
+				OutputString &text = nextScratch();
+				if constexpr (isNarrowString<T>) appendOutput(text, std::string_view(arg));
+				else appendOutput(text, std::wstring_view(arg));
+				return std::as_const(text);
 			}
+#ifdef _WIN32
 			// If type provides a wstring() method, use it directly.
 			else if constexpr (has_wstring<T>::value) {
-				converted.push(arg.wstring());
-				return converted.back();
+				OutputString &text = nextScratch();
+				text += arg.wstring();
+				return std::as_const(text);
 			}
 			// If type provides a string() method, convert it to wstring.
 			else if constexpr (has_string<T>::value) {
-				converted.push(toWString(arg.string()));
-				return converted.back();
+				OutputString &text = nextScratch();
+				appendOutput(text, std::string_view(arg.string()));
+				return std::as_const(text);
+			}
+#else
+			// If type provides a string() method, use it directly.
+			else if constexpr (has_string<T>::value) {
+				OutputString &text = nextScratch();
+				text += arg.string();
+				return std::as_const(text);
+			}
+			// If type provides a wstring() method, convert it to UTF-8.
+			else if constexpr (has_wstring<T>::value) {
+				OutputString &text = nextScratch();
+				appendOutput(text, std::wstring_view(arg.wstring()));
+				return std::as_const(text);
 			}
+			// Types only formattable as wide text (e.g. wchar_t) are formatted eagerly and converted.
+			else if constexpr (!std::is_default_constructible_v<std::formatter<T, char>> && std::is_default_constructible_v<std::formatter<T, wchar_t>>) {
+				OutputString &text = nextScratch();
+				appendOutput(text, std::wstring_view(std::format(L"{}", arg)));
+				return std::as_const(text);
+			}
+#endif
 			// Otherwise, return the argument itself.
 			else return arg;
 		}
 
-		// Convert any argument into std::wstring for formatting.
-		// Returns the original value if already wide string, otherwise uses std::format.
+		// Convert any argument into text in the output encoding for formatting.
+		// Returns the original value if already in the output encoding, otherwise formats it into a scratch string.
 		template<typename T>
-		static auto &convertArgumentToWString(const T &arg) {
-			// If already a std::wstring or convertible to const wchar_t*, return directly.
-			if constexpr (std::is_same_v<T, std::wstring> || std::is_convertible_v<T, const wchar_t *>) return arg;
-			// Otherwise, format the argument into a wide string using std::format.
+		static auto &convertArgumentToOutput(const T &arg) {
+			if constexpr (isOutputString<T>) return arg;
 			else {
-				converted.push(std::format(L"{}", arg));
-				return converted.back();
+				OutputString &text = nextScratch();
+				if constexpr (std::is_same_v<OutputChar, char>) std::format_to(std::back_inserter(text), "{}", arg);
+				else std::format_to(std::back_inserter(text), L"{}", arg);
+				return std::as_const(text);
 			}
 		}
 
-		// Clear temporary converted string cache.
-		static void clearConverted() { converted = std::queue<std::wstring>(); }
+		// Convert an argument into a self-contained value that can still be formatted after the call returns.
+		// Strings are copied, trivially copyable values are kept as-is, other types are converted eagerly.
+		template<typename T>
+		static auto captureArgument(const T &arg) {
+			if constexpr (std::is_convertible_v<T, const char *> || std::is_same_v<T, std::string_view>) return std::string(arg);
+			else if constexpr (std::is_convertible_v<T, const wchar_t *> || std::is_same_v<T, std::wstring_view>) return std::wstring(arg);
+			else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::wstring>) return arg;
+#ifdef _WIN32
+			else if constexpr (has_wstring<T>::value) return std::wstring(arg.wstring());
+			else if constexpr (has_string<T>::value) return toWString(arg.string());
+#else
+			else if constexpr (has_string<T>::value) return std::string(arg.string());
+			else if constexpr (has_wstring<T>::value) return toString(arg.wstring());
+#endif
+			else if constexpr (std::is_trivially_copyable_v<T>) return arg;
+			else if constexpr (std::is_default_constructible_v<std::formatter<T, OutputChar>>) return formatValue(arg);
+			else return std::format(L"{}", arg);
+		}
+
+		// Capture a message format, string literals keep their pointer since they outlive the call.
+		template<typename T>
+		static auto captureMessage(const T &message) {
+			if constexpr (isLiteral<T>) return message;
+			else return captureArgument(message);
+		}
+
+		// Message format as passed to the formatter, the text of a literal or the message itself.
+		template<typename T>
+		static const auto &formatOf(const T &message) noexcept {
+			if constexpr (isLiteral<T>) return message.text;
+			else return message;
+		}
+
+		// Format a message with optional arguments, returning the formatted text in the output encoding.
+		template<typename MessageType, typename... Args>
+		static OutputString formatMessage(const MessageType &message, const Args &...args) {
+			OutputString formatted;
+			formatMessageTo(formatted, message, args...);
+			return formatted;
+		}
 
-		// Format a message with optional arguments, returning the formatted wide string.
+		// Format a message with optional arguments, appending the text in the output encoding to `out`.
+		// Allocates nothing once `out` and the scratch strings of this thread have grown to the message size.
 		template<typename MessageType, typename... Args>
-		static std::wstring formatMessage(const MessageType &message, const Args &...args) {
-			// Convert message to wide string format.
-			const auto convertedMessage = convertFormatting(message);
-			const std::wstring msg = convertArgumentToWString(convertedMessage);
-			std::wstring formatted = msg;
+		static void formatMessageTo(OutputString &out, const MessageType &message, const Args &...args) {
+			const ScratchScope scope;
+
+			// Convert message to the output encoding.
+			const OutputView format(convertArgumentToOutput(convertFormatting(formatOf(message))));
 
 			// Format message with arguments if provided.
 			if constexpr (sizeof...(args) > 0) {
+				const size_t start = out.size();
 				try {
-					// Use std::vformat for argument substitution.
-					formatted = std::vformat(msg, std::make_wformat_args(convertFormatting(args)...));
-					// Clear conversion cache after successful formatting.
-					clearConverted();
+					// Use std::vformat_to for argument substitution.
+#ifdef _WIN32
+					std::vformat_to(std::back_inserter(out), format, std::make_wformat_args(convertFormatting(args)...));
+#else
+					std::vformat_to(std::back_inserter(out), format, std::make_format_args(convertFormatting(args)...));
+#endif
 				} catch (const std::exception &e) {
-					// Append error message if formatting fails.
-					formatted = msg + L"\2478\247o (" + toWString(e.what()) + L')';
+					// Output the unformatted message with the error appended if formatting fails.
+					out.resize(start);
+					out += format;
+#ifdef _WIN32
+					out += L"\2478\247o (" + toWString(e.what()) + L')';
+#else
+					out += std::string("\302\2478\302\247o (") + e.what() + ')';
+#endif
 				}
-			}
-
-			return formatted;
+			} else out += format;
 		}
 	};
 
+	// Severity of a log message, in increasing order.
+	enum class LogLevel : unsigned char {
+		Trace = KLY_LOGGER_LEVEL_TRACE,
+		Debug = KLY_LOGGER_LEVEL_DEBUG,
+		Info = KLY_LOGGER_LEVEL_INFO,
+		Warn = KLY_LOGGER_LEVEL_WARN,
+		Error = KLY_LOGGER_LEVEL_ERROR,
+		Fatal = KLY_LOGGER_LEVEL_FATAL,
+		// Only usable as a threshold, disables all output.
+		Off = KLY_LOGGER_LEVEL_OFF
+	};
+
+	// Whether a log level is compiled into the program (see KLY_LOGGER_OPTION_MIN_LEVEL).
+	static constexpr bool isCompiledIn(LogLevel level) noexcept {
+#if KLY_LOGGER_OPTION_MIN_LEVEL > KLY_LOGGER_LEVEL_TRACE
+		if (static_cast<int>(level) < KLY_LOGGER_OPTION_MIN_LEVEL) return false;
+#endif
+		return level != LogLevel::Off;
+	}
+
+	// Resolution of the time shown in the log header.
+	enum class TimePrecision : unsigned char {
+		// HH:MM:SS
+		Seconds,
+		// HH:MM:SS.mmm
+		Milliseconds,
+		// HH:MM:SS.uuuuuu
+		Microseconds
+	};
+
+	// Console output when stderr is not a terminal, e.g. a pipe to a container log collector (see setStreamFormat()).
+	enum class StreamFormat : unsigned char {
+		// No console output.
+		None,
+		// Lines as written to the log file, without color codes.
+		Plain,
+		// One JSON object per record: {"time":"2025-01-01T12:34:56.789Z","level":"INFO","logger":"Main","message":"Started"}.
+		JsonLines
+	};
+
+	// How the log file shows the fields attached to a log call with kv() (see setFieldFormat()).
+	enum class FieldFormat : unsigned char {
+		// key=value pairs after the message, e.g. "[12:34:56 INFO] [Main] Request done ms=12 user=alice".
+		Logfmt,
+		// Every record as a JSON object like StreamFormat::JsonLines, with the fields as further members.
+		JsonLines
+	};
+
 private:
 	// LogStyle encapsulates all visual and textual attributes for a log level,
 	// including level name, Windows console colors, and ANSI escape sequences.
 	static constexpr struct LogStyle {
 		const std::string level, levelAnsiColor, textAnsiColor;
 		const unsigned short levelColor, textColor;
-	} INFO_STYLE{"INFO", "\33[0;92m", "\33[0;37m", 10, 7}, WARN_STYLE{"WARN", "\33[0;33m", "\33[0;93m", 6, 14},
-	ERROR_STYLE{"ERROR", "\33[0;31m", "\33[0;91m", 4, 12}, FATAL_STYLE{"FATAL", "\33[2;31m", "\33[0;31m", 32772, 4};
+		const LogLevel severity;
+	} TRACE_STYLE{"TRACE", "\33[0;90m", "\33[0;90m", 8, 8, LogLevel::Trace}, DEBUG_STYLE{"DEBUG", "\33[0;96m", "\33[0;37m", 11, 7, LogLevel::Debug},
+	INFO_STYLE{"INFO", "\33[0;92m", "\33[0;37m", 10, 7, LogLevel::Info}, WARN_STYLE{"WARN", "\33[0;33m", "\33[0;93m", 6, 14, LogLevel::Warn},
+	ERROR_STYLE{"ERROR", "\33[0;31m", "\33[0;91m", 4, 12, LogLevel::Error}, FATAL_STYLE{"FATAL", "\33[2;31m", "\33[0;31m", 32772, 4, LogLevel::Fatal};
+
+	// All log styles, indexed by log level.
+	static constexpr const LogStyle *LOG_STYLES[]{&TRACE_STYLE, &DEBUG_STYLE, &INFO_STYLE, &WARN_STYLE, &ERROR_STYLE, &FATAL_STYLE};
+
+	// Start of every ANSI console log header, up to the time.
+	static constexpr std::string_view ANSI_HEADER_PREFIX = "\33[0;36m\r[\33[0;36m";
 
 	// Lookup tables: convert Minecraft color codes to ANSI sequences.
 	static constexpr const char *mcToAnsiEscape[]{
 			"\33[30m",	 "\33[0;34m", "\33[0;32m", "\33[0;36m", "\33[0;31m", "\33[0;35m", "\33[0;33m", "\33[0;37m",
 			"\33[0;90m", "\33[0;94m", "\33[0;92m", "\33[0;96m", "\33[0;91m", "\33[0;95m", "\33[0;93m", "\33[0;97m" };
 
-	// Log task containing logger name, log message and log style.
-	struct LogTask {
-		const LogStyle style;
-		const std::wstring name, message;
-	};
+	// Per-thread pools of fixed-size memory blocks for log messages that do not fit into a LogMessage.
+	// The thread logging a message takes a block from its own pool, and whichever thread destroys the message
+	// (usually the logging thread after writing it) pushes the block back onto a lock-free list of that pool,
+	// which the owner takes over as a whole once its own free blocks run out. After warming up, logging thus
+	// allocates no memory. Pools of exited threads are handed on to new threads and are never freed.
+	class MessagePool {
+		static constexpr size_t BLOCK_SIZES[]{128, 512, 2048, 8192};
+		static constexpr size_t CLASSES = std::size(BLOCK_SIZES);
 
-	// Platform-specific console handling.
-	class ConsoleHelper {
-	public:
-		static inline std::unordered_map<wchar_t, std::pair<unsigned short, std::string>> mappings = {
-				{ L'k', { 7, "\33[5m" } }, { L'l', { 7, "\33[21m" } }, { L'm', { 7, "\33[9m" } },
-				{ L'n', { 7, "\33[4m" } }, { L'o', { 7, "\33[3m" } },  { L'r', { 7, "\33[m"} } };
+		// Block header, followed by the usable memory.
+		struct alignas(std::max_align_t) Block {
+			MessagePool *owner;
+			Block *next;
+			size_t sizeClass;
+		};
 
-		// Initialize console and check if console supports ANSI escape sequences.
-		static bool initialize() {
-#ifdef _WIN32
-			// If the output is not a terminal, then ANSI sequences are not supported.
-			if (!isAtty) return false;
+		// Free blocks of each size, taken only by the owner thread.
+		Block *freeBlocks[CLASSES]{};
+		// Blocks given back by other threads, taken over by the owner thread as a whole.
+		std::atomic<Block *> returnedBlocks[CLASSES]{};
+		MessagePool *nextOrphan = nullptr;
 
-			RTL_OSVERSIONINFOEXW osInfo{};
-			osInfo.dwOSVersionInfoSize = sizeof(osInfo);
+		static inline MessagePool *orphans;
+		static inline std::atomic_flag orphansBusy;
 
-			// Get OS version using RtlGetVersion.
-			// If the call fails or the system is older than Windows 10,
-			// then ANSI sequences are not supported.
-			if (RtlGetVersion(&osInfo) || osInfo.dwMajorVersion < 10) return false;
+		// Pool of the current thread, adopted from an exited thread if possible.
+		struct Owner {
+			MessagePool *pool;
 
-			unsigned long mode;
-			if (GetConsoleMode(getHandle(), &mode)) {
-				// Enable "virtual terminal processing" in the console mode.
-				// This makes the console recognize ANSI escape sequences.
-				return SetConsoleMode(getHandle(), mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+			Owner() {
+				while (orphansBusy.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+				pool = orphans;
+				if (pool) orphans = pool->nextOrphan;
+				orphansBusy.clear(std::memory_order_release);
+				if (!pool) pool = new MessagePool();
 			}
 
-			// If we cannot get the console mode, assume ANSI is unsupported.
-			return false;
-#else
-			return isAtty;
-#endif
-		}
-
-		// Set the text color for current console output.
-		static void setColor(unsigned short color, const std::string &ansi) {
-			if (!isAtty) return;
+			~Owner() {
+				while (orphansBusy.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+				pool->nextOrphan = orphans;
+				orphans = pool;
+				orphansBusy.clear(std::memory_order_release);
+			}
+		};
 
-			if (ansiSupported) lineBuffer += StringConverter::toWString(ansi.begin(), ansi.end());
-#ifdef _WIN32
-			else SetConsoleTextAttribute(getHandle(), color);
-#endif
+		static MessagePool &local() {
+			static thread_local Owner owner;
+			return *owner.pool;
 		}
 
-		// Get the text attributes of the current console text.
-		static unsigned short getTextAttribute() {
-#ifdef _WIN32
-			CONSOLE_SCREEN_BUFFER_INFO csbi;
-			return GetConsoleScreenBufferInfo(getHandle(), &csbi) ? csbi.wAttributes : 7;
-#else
-			return 0;
-#endif
-		}
+	public:
+		// Memory for `size` bytes aligned like std::max_align_t, from the pool of the current thread unless it is larger than the largest block.
+		static void *allocate(size_t size) {
+			size_t sizeClass = 0;
+			while (sizeClass < CLASSES && BLOCK_SIZES[sizeClass] < size) sizeClass++;
+			if (sizeClass == CLASSES) return new (::operator new(sizeof(Block) + size)) Block{nullptr, nullptr, 0} + 1;
 
-		// Output string to console and log file.
-		static void write(const std::string &msg) {
-			if (isAtty) {
-				lineBuffer += StringConverter::toWString(msg.begin(), msg.end());
-#ifdef _WIN32
-				if (!ansiSupported) WriteConsoleA(getHandle(), msg.c_str(), static_cast<unsigned>(msg.length()), nullptr, nullptr);
-#endif
-			}
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			if (logFile.is_open()) logFile << msg;
-#endif
+			MessagePool &pool = local();
+			Block *block = pool.freeBlocks[sizeClass];
+			if (!block) block = pool.returnedBlocks[sizeClass].exchange(nullptr, std::memory_order_acquire);
+			if (block) pool.freeBlocks[sizeClass] = block->next;
+			else block = new (::operator new(sizeof(Block) + BLOCK_SIZES[sizeClass])) Block{&pool, nullptr, sizeClass};
+			return block + 1;
 		}
 
-		// Output wide string to console and log file.
-		static void write(const std::wstring &msg) {
-			if (isAtty) {
-				if (ansiSupported) lineBuffer += msg;
-#ifdef _WIN32
-				else WriteConsoleW(getHandle(), msg.c_str(), static_cast<unsigned>(msg.length()), nullptr, nullptr);
-#endif
+		// Give memory from allocate() back to the pool it came from, from any thread.
+		static void release(void *memory) noexcept {
+			Block *block = static_cast<Block *>(memory) - 1;
+			if (!block->owner) {
+				::operator delete(block);
+				return;
 			}
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			if (logFile.is_open()) logFile << StringConverter::toString(msg);
-#endif
+			std::atomic<Block *> &returned = block->owner->returnedBlocks[block->sizeClass];
+			block->next = returned.load(std::memory_order_relaxed);
+			while (!returned.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed)) {}
 		}
+	};
 
-		// Flush buffered line content to console and log file.
-		static void flushLine() {
-#ifdef _WIN32
-			if (ansiSupported) {
-				lineBuffer.push_back(L'\n');
-				WriteConsoleW(getHandle(), lineBuffer.c_str(), static_cast<unsigned>(lineBuffer.length()), nullptr, nullptr);
-			} else WriteConsoleA(getHandle(), "\n", 1, nullptr, nullptr);
-#else
-			std::cerr << StringConverter::toString(lineBuffer) << std::endl;
-#endif
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			if (logFile.is_open()) logFile << std::endl;
-#endif
-			lineBuffer.clear();
+	// Message text formatted on the caller thread, short enough to be stored inside the LogMessage.
+	struct InlineText {
+		static constexpr size_t CAPACITY = (95 / sizeof(OutputChar));
+
+		OutputChar data[CAPACITY];
+		unsigned char length;
+
+		explicit InlineText(OutputView text) noexcept : length(static_cast<unsigned char>(text.length())) { text.copy(data, text.length()); }
+
+		OutputString operator()() const { return OutputString(view()); }
+
+		[[nodiscard]] OutputView view() const noexcept { return {data, length}; }
+	};
+
+	// Message text formatted on the caller thread, stored in a block of its MessagePool.
+	struct PooledText {
+		OutputChar *data;
+		size_t length;
+
+		explicit PooledText(OutputView text) : data(static_cast<OutputChar *>(MessagePool::allocate(text.length() * sizeof(OutputChar)))), length(text.length()) {
+			text.copy(data, length);
 		}
 
-		// Clear remaining content in current line.
-		static void clearLine() {
-			if (!isAtty) return;
+		PooledText(PooledText &&other) noexcept : data(std::exchange(other.data, nullptr)), length(other.length) {}
 
-			// Clear any remaining text to the right of the cursor.
-			if (ansiSupported) lineBuffer += L"\33[m\33[K";
-#ifdef _WIN32
-			else {
-				// On Windows without ANSI, fill the rest of the line with spaces and reset attributes.
-				SetConsoleTextAttribute(getHandle(), 7);
-				CONSOLE_SCREEN_BUFFER_INFO csbi;
-				if (GetConsoleScreenBufferInfo(getHandle(), &csbi)) {
-					unsigned long length = csbi.dwSize.X - csbi.dwCursorPosition.X;
-					FillConsoleOutputCharacterA(getHandle(), ' ', length, csbi.dwCursorPosition, &length);
-					FillConsoleOutputAttribute(getHandle(), csbi.wAttributes, length, csbi.dwCursorPosition, &length);
-				}
-			}
-#endif
+		~PooledText() {
+			if (data) MessagePool::release(data);
 		}
 
-		// Update dynamic color mappings and find the specified color code.
-		static auto updateMappingsAndFind(const wchar_t code, unsigned short initialColor, const std::string &ansiColor) {
-			const unsigned short attribute = getTextAttribute();
+		OutputString operator()() const { return OutputString(view()); }
+
+		[[nodiscard]] OutputView view() const noexcept { return {data, length}; }
+	};
+
+	// Type-erased log message, either already formatted or the captured raw arguments of a deferred call
+	// that the logging thread formats. Small captures are stored inline, larger ones in a MessagePool block.
+	class LogMessage {
+		static constexpr size_t inlineCapacity = 96;
+
+		struct Operations {
+			OutputString (*format)(void *storage);
+			const OutputChar *(*view)(void *storage, size_t &length);
+			const void *(*encode)(void *storage, std::string &arguments, size_t &count);
+			std::string (*formatString)(void *storage);
+			std::string_view (*fields)(void *storage);
+			void (*relocate)(void *from, void *to) noexcept;
+			void (*destroy)(void *storage) noexcept;
+		};
+
+		// Operations for a capture type, stored inline or behind a pointer to a MessagePool block (or to the heap if it is over-aligned).
+		template<typename Capture, bool Inline, bool Pooled = !Inline>
+		struct Model {
+			static Capture *get(void *storage) noexcept {
+				if constexpr (Inline) return std::launder(static_cast<Capture *>(storage));
+				else return *static_cast<Capture **>(storage);
+			}
+
+			static OutputString format(void *storage) { return (*get(storage))(); }
+
+			static const OutputChar *view(void *storage, size_t &length) {
+				if constexpr (requires(const Capture &capture) { capture.view(); }) {
+					const OutputView text = get(storage)->view();
+					length = text.length();
+					return text.data();
+				} else return nullptr;
+			}
+
+			static const void *encode(void *storage, std::string &arguments, size_t &count) {
+				if constexpr (requires(const Capture &capture, std::string &out, size_t &n) { capture.encode(out, n); }) return get(storage)->encode(arguments, count);
+				else return nullptr;
+			}
+
+			static std::string formatString(void *storage) {
+				if constexpr (requires(const Capture &capture) { capture.formatString(); }) return get(storage)->formatString();
+				else return {};
+			}
+
+			static std::string_view fields(void *storage) {
+				if constexpr (requires(const Capture &capture) { capture.fields(); }) return get(storage)->fields();
+				else return {};
+			}
+
+			static void relocate(void *from, void *to) noexcept {
+				if constexpr (Inline) {
+					new (to) Capture(std::move(*get(from)));
+					get(from)->~Capture();
+				} else *static_cast<Capture **>(to) = get(from);
+			}
+
+			static void destroy(void *storage) noexcept {
+				if constexpr (Pooled) {
+					Capture *capture = get(storage);
+					capture->~Capture();
+					MessagePool::release(capture);
+				} else if constexpr (Inline) get(storage)->~Capture();
+				else delete get(storage);
+			}
+
+			static constexpr Operations operations{format, view, encode, formatString, fields, relocate, destroy};
+		};
+
+		const Operations *operations = nullptr;
+		alignas(std::max_align_t) unsigned char storage[inlineCapacity];
+
+	public:
+		template<typename Capture> requires (!std::is_same_v<std::decay_t<Capture>, LogMessage>)
+		explicit LogMessage(Capture &&capture) {
+			using Type = std::decay_t<Capture>;
+			if constexpr (sizeof(Type) <= inlineCapacity && alignof(Type) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<Type>) {
+				new (storage) Type(std::forward<Capture>(capture));
+				operations = &Model<Type, true>::operations;
+			} else if constexpr (alignof(Type) > alignof(std::max_align_t)) {
+				*reinterpret_cast<Type **>(storage) = new Type(std::forward<Capture>(capture));
+				operations = &Model<Type, false, false>::operations;
+			} else {
+				void *memory = MessagePool::allocate(sizeof(Type));
+				try {
+					*reinterpret_cast<Type **>(storage) = new (memory) Type(std::forward<Capture>(capture));
+				} catch (...) {
+					MessagePool::release(memory);
+					throw;
+				}
+				operations = &Model<Type, false>::operations;
+			}
+		}
+
+		LogMessage(LogMessage &&other) noexcept : operations(other.operations) {
+			if (operations) operations->relocate(other.storage, storage);
+			other.operations = nullptr;
+		}
+
+		LogMessage &operator=(LogMessage &&) = delete;
+
+		~LogMessage() {
+			if (operations) operations->destroy(storage);
+		}
+
+		// Produce the final message text (may only be called once).
+		OutputString format() { return operations->format(storage); }
+
+		// Text of a message formatted on the caller thread without copying it, or nullptr if it still needs formatting.
+		const OutputChar *view(size_t &length) { return operations->view(storage, length); }
+
+		// Append the encoded arguments of a deferred message to `arguments` and store their number in `count`.
+		// Returns the address of the literal format, or nullptr if the message cannot be stored as a binary record.
+		const void *encode(std::string &arguments, size_t &count) { return operations->encode(storage, arguments, count); }
+
+		// Format string of a message that encode() accepted, as UTF-8.
+		std::string formatString() { return operations->formatString(storage); }
+
+		// Fields attached to the log call with kv(), encoded by FieldCodec, empty if there are none.
+		std::string_view fields() { return operations->fields(storage); }
+	};
+
+	// Message of a sampled log call, prefixed with "[sample 1/N] " where N is the number of calls one output line stands for.
+	template<typename Capture>
+	struct SampledMessage {
+		Capture capture;
+		double rate;
+
+		OutputString operator()() {
+			OutputString text;
+			appendSampleMarker(text, rate);
+			return text + capture();
+		}
+	};
+
+	// Fields of a log call encoded by FieldCodec, in a MessagePool block.
+	struct PooledFields {
+		char *data;
+		size_t length;
+
+		explicit PooledFields(std::string_view fields) : data(static_cast<char *>(MessagePool::allocate(fields.length()))), length(fields.length()) {
+			fields.copy(data, length);
+		}
+
+		PooledFields(PooledFields &&other) noexcept : data(std::exchange(other.data, nullptr)), length(other.length) {}
+
+		~PooledFields() {
+			if (data) MessagePool::release(data);
+		}
+
+		[[nodiscard]] std::string_view view() const noexcept { return {data, length}; }
+	};
+
+	// Message of a log call with fields, which are encoded on the calling thread in both formatting modes.
+	template<typename Capture>
+	struct FieldMessage {
+		Capture capture;
+		PooledFields encoded;
+
+		OutputString operator()() { return capture(); }
+
+		[[nodiscard]] OutputView view() const noexcept requires requires(const Capture &text) { text.view(); } { return capture.view(); }
+
+		[[nodiscard]] std::string_view fields() const noexcept { return encoded.view(); }
+	};
+
+	// Append the "[sample 1/N] " prefix of a sampled message, N is shown with decimals unless it is a whole number.
+	static void appendSampleMarker(OutputString &out, double rate) {
+		char marker[64];
+		const auto whole = static_cast<std::uint64_t>(rate + 0.5);
+		const double difference = rate - static_cast<double>(whole);
+		const char *end = difference < rate * 1e-9 && difference > -rate * 1e-9 ? std::format_to_n(marker, sizeof(marker), "[sample 1/{}] ", whole).out
+				: std::format_to_n(marker, sizeof(marker), "[sample 1/{:.3f}] ", rate).out;
+		out.append(static_cast<const char *>(marker), end);
+	}
+
+	// Message format and arguments captured on the caller thread, formatted on the logging thread.
+	template<typename MessageType, typename... Args>
+	struct DeferredMessage {
+		MessageType message;
+		std::tuple<Args...> args;
+
+		OutputString operator()() {
+			return std::apply([this](const auto &...values) { return StringConverter::formatMessage(message, values...); }, args);
+		}
+
+		// Only messages with a format marked with literal() and arguments of the types BinaryLog supports can be encoded. The address of a literal
+		// identifies its text for good, so it keys the call site dictionary; copied formats are written as text instead.
+		const void *encode([[maybe_unused]] std::string &out, [[maybe_unused]] size_t &count) const {
+			if constexpr (StringConverter::isLiteral<MessageType> && (BinaryLog::isEncodable<Args> && ...)) {
+				count = sizeof...(Args);
+				std::apply([&out](const auto &...values) { (BinaryLog::putArgument(out, values), ...); }, args);
+				return message.text;
+			} else return nullptr;
+		}
+
+		std::string formatString() const {
+			if constexpr (std::is_same_v<MessageType, StringConverter::Literal<char>>) return message.text;
+			else if constexpr (std::is_same_v<MessageType, StringConverter::Literal<wchar_t>>) return StringConverter::toString(message.text);
+			else return {};
+		}
+	};
+
+	// Interned logger identity, shared by all loggers with the same name and never freed.
+	// Holds the name in the output encoding and the log header after the time for every level,
+	// pre-rendered once by the thread writing the console or the file sink.
+	struct LoggerEntry {
+		const std::wstring name;
+		const OutputString outputName;
+		LoggerEntry *next = nullptr;
+		bool consoleRendered = false, fileRendered = false, streamRendered = false;
+		OutputString consoleHeaders[std::size(LOG_STYLES)]{};
+		std::string fileHeaders[std::size(LOG_STYLES)]{};
+		// Headers of StreamFormat::Plain and the name as a JSON string, rendered by the thread writing the console sink.
+		std::string streamHeaders[std::size(LOG_STYLES)]{}, streamName{};
+		// Name as a JSON string for FieldFormat::JsonLines, rendered with the file headers.
+		std::string fileJsonName{};
+	};
+
+	// Log task containing logger identity, log message, log style and the time of the log call.
+	struct LogTask {
+		const LogStyle *style;
+		LoggerEntry *logger;
+		std::int64_t timestamp;
+		LogMessage message;
+	};
+
+	// Bounded lock-free queue based on per-cell sequence numbers (Dmitry Vyukov's design).
+	// Any number of threads may push; the logging thread is the regular consumer, and producers
+	// only pop themselves when evicting the oldest task under OverflowPolicy::OverwriteOldest.
+	template<typename T, size_t Capacity>
+	class RingBuffer {
+		static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Ring buffer capacity must be a power of two.");
+
+		struct Cell {
+			std::atomic_size_t sequence;
+			alignas(T) unsigned char storage[sizeof(T)];
+		};
+
+		Cell cells[Capacity];
+		alignas(64) std::atomic_size_t enqueuePos{0};
+		alignas(64) std::atomic_size_t dequeuePos{0};
+
+	public:
+		RingBuffer() noexcept {
+			for (size_t i = 0; i < Capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		~RingBuffer() {
+			while (tryPop()) {}
+		}
+
+		RingBuffer(const RingBuffer &) = delete;
+		RingBuffer &operator=(const RingBuffer &) = delete;
+
+		// Construct an element in the next free cell, returns false if the queue is full.
+		template<typename... Args>
+		bool tryPush(Args &&...args) {
+			size_t pos = enqueuePos.load(std::memory_order_relaxed);
+			while (true) {
+				Cell &cell = cells[pos & (Capacity - 1)];
+				const auto diff = static_cast<std::ptrdiff_t>(cell.sequence.load(std::memory_order_acquire) - pos);
+				if (diff == 0) {
+					if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						new (cell.storage) T{std::forward<Args>(args)...};
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) return false;
+				else pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Move the oldest element out of the queue, returns std::nullopt if the queue is empty.
+		std::optional<T> tryPop() {
+			size_t pos = dequeuePos.load(std::memory_order_relaxed);
+			while (true) {
+				Cell &cell = cells[pos & (Capacity - 1)];
+				const auto diff = static_cast<std::ptrdiff_t>(cell.sequence.load(std::memory_order_acquire) - (pos + 1));
+				if (diff == 0) {
+					if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						T *element = std::launder(reinterpret_cast<T *>(cell.storage));
+						std::optional<T> result(std::move(*element));
+						element->~T();
+						cell.sequence.store(pos + Capacity, std::memory_order_release);
+						return result;
+					}
+				} else if (diff < 0) return std::nullopt;
+				else pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		// Approximate number of queued elements.
+		[[nodiscard]] size_t size() const noexcept {
+			const size_t head = dequeuePos.load(std::memory_order_relaxed), tail = enqueuePos.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+
+		[[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+		[[nodiscard]] bool full() const noexcept { return size() >= Capacity; }
+	};
+
+	// Parks threads until another thread signals progress (futex on Linux, condition variable on Windows).
+	// Signalling is a fence plus a load while nobody is parked, so producers can call notify() on every log call.
+	// A process-shared notifier lives zero-initialized in shared memory and wakes threads of any process (Linux only).
+	template<bool ProcessShared = false>
+	class BasicNotifier {
+		std::atomic_uint32_t epoch, waiters;
+#ifdef _WIN32
+		SRWLOCK lock;
+		CONDITION_VARIABLE condition;
+#endif
+
+	public:
+#ifdef _WIN32
+		BasicNotifier() noexcept : epoch(0), waiters(0), lock(SRWLOCK_INIT), condition(CONDITION_VARIABLE_INIT) {}
+#else
+		BasicNotifier() noexcept : epoch(0), waiters(0) {}
+#endif
+
+		// Wake all parked threads.
+		void notify() noexcept {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!waiters.load(std::memory_order_relaxed)) return;
+#ifdef _WIN32
+			AcquireSRWLockExclusive(&lock);
+			epoch.fetch_add(1, std::memory_order_release);
+			ReleaseSRWLockExclusive(&lock);
+			WakeAllConditionVariable(&condition);
+#else
+			epoch.fetch_add(1, std::memory_order_release);
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch), ProcessShared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+		}
+
+		// Park until notified or the timeout expires (negative waits forever), unless ready() already holds.
+		template<typename Predicate>
+		void waitUntil(const Predicate &ready, std::chrono::nanoseconds timeout) noexcept {
+			const uint32_t observed = epoch.load(std::memory_order_acquire);
+			waiters.fetch_add(1, std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (!ready()) {
+#ifdef _WIN32
+				const unsigned long milliseconds = timeout.count() < 0 ? INFINITE
+						: static_cast<unsigned long>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count());
+				AcquireSRWLockExclusive(&lock);
+				if (epoch.load(std::memory_order_relaxed) == observed) SleepConditionVariableSRW(&condition, &lock, milliseconds, 0);
+				ReleaseSRWLockExclusive(&lock);
+#else
+				timespec duration{static_cast<time_t>(timeout.count() / 1000000000), static_cast<long>(timeout.count() % 1000000000)};
+				syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch), ProcessShared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, observed, timeout.count() < 0 ? nullptr : &duration, nullptr, 0);
+#endif
+			}
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+	};
+
+	using Notifier = BasicNotifier<>;
+
+	// Number of buckets of a latency histogram, one per power of two of nanoseconds.
+	static constexpr size_t LATENCY_BUCKETS = 64;
+
+	// Add to a statistics counter that only one thread changes, so no locked instruction is needed.
+	static void increase(std::atomic_uint64_t &counter, std::uint64_t amount) noexcept {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// Histogram of latencies in nanoseconds, changed by one thread and read by stats() (see LatencyHistogram).
+	struct LatencyCounter {
+		std::atomic_uint64_t buckets[LATENCY_BUCKETS];
+
+		void add(std::int64_t nanoseconds) noexcept {
+			increase(buckets[std::bit_width(static_cast<std::uint64_t>(std::max<std::int64_t>(nanoseconds, 0)))], 1);
+		}
+	};
+
+	// Vectorized search for the characters that need special handling in log text: CR, LF and the '§' color code marker.
+	// Uses AVX2 when the compiler targets it, SSE2 on other x86 builds and a scalar loop everywhere else.
+	// In UTF-8 the marker is the byte pair C2 A7, so the search stops at C2 and checks the byte after it.
+	class TextScanner {
+	public:
+		// Length of the '§' marker in output characters.
+		static constexpr size_t MARKER_LENGTH = sizeof(OutputChar) == 1 ? 2 : 1;
+
+		static constexpr bool isLineBreak(OutputChar c) noexcept { return c == '\r' || c == '\n'; }
+
+		// Whether the '§' marker starts at `pos`.
+		static constexpr bool isMarkerAt(OutputView text, size_t pos) noexcept {
+			return text[pos] == MARKER_LEAD && (MARKER_LENGTH == 1 || (pos + 1 < text.length() && text[pos + 1] == MARKER_TRAIL));
+		}
+
+		// Number of output characters taken by the character starting at `pos` (a UTF-8 sequence, or one wide character).
+		static constexpr size_t characterLength(OutputView text, size_t pos) noexcept {
+			size_t length = 1;
+			if constexpr (sizeof(OutputChar) == 1) {
+				while (length < 4 && pos + length < text.length() && (static_cast<unsigned char>(text[pos + length]) & 0xC0) == 0x80) length++;
+			}
+			return length;
+		}
+
+		// Position of the first CR, LF or '§' at or after `start`, or the text length if there is none.
+		static size_t findSpecial(OutputView text, size_t start) noexcept {
+			while (true) {
+				const size_t found = findCandidate(text, start);
+				if (found == text.length() || isLineBreak(text[found]) || isMarkerAt(text, found)) return found;
+				start = found + 1;
+			}
+		}
+
+	private:
+		// First (or only) and second unit of the '§' marker.
+		static constexpr OutputChar MARKER_LEAD = static_cast<OutputChar>(MARKER_LENGTH == 1 ? 0xA7 : 0xC2);
+		static constexpr OutputChar MARKER_TRAIL = static_cast<OutputChar>(0xA7);
+
+		static constexpr bool isCandidate(OutputChar c) noexcept { return c == '\r' || c == '\n' || c == MARKER_LEAD; }
+
+		// Position of the first CR, LF or marker lead unit at or after `start`, or the text length if there is none.
+		static size_t findCandidate(OutputView text, size_t start) noexcept {
+			const OutputChar *data = text.data();
+			const size_t length = text.length();
+			size_t i = start;
+#ifdef __AVX2__
+			constexpr size_t wideLanes = 32 / sizeof(OutputChar);
+			const __m256i cr256 = broadcast256('\r'), lf256 = broadcast256('\n'), marker256 = broadcast256(MARKER_LEAD);
+			for (; i + wideLanes <= length; i += wideLanes) {
+				const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+				const __m256i hits = _mm256_or_si256(_mm256_or_si256(equal256(chunk, cr256), equal256(chunk, lf256)), equal256(chunk, marker256));
+				if (const auto mask = static_cast<unsigned>(_mm256_movemask_epi8(hits))) return i + std::countr_zero(mask) / sizeof(OutputChar);
+			}
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+			constexpr size_t lanes = 16 / sizeof(OutputChar);
+			const __m128i cr = broadcast128('\r'), lf = broadcast128('\n'), marker = broadcast128(MARKER_LEAD);
+			for (; i + lanes <= length; i += lanes) {
+				const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+				const __m128i hits = _mm_or_si128(_mm_or_si128(equal128(chunk, cr), equal128(chunk, lf)), equal128(chunk, marker));
+				if (const auto mask = static_cast<unsigned>(_mm_movemask_epi8(hits))) return i + std::countr_zero(mask) / sizeof(OutputChar);
+			}
+#endif
+			for (; i < length; i++) {
+				if (isCandidate(data[i])) return i;
+			}
+			return length;
+		}
+
+#ifdef __AVX2__
+		static __m256i broadcast256(OutputChar c) noexcept {
+			if constexpr (sizeof(OutputChar) == 1) return _mm256_set1_epi8(static_cast<char>(c));
+			else if constexpr (sizeof(OutputChar) == 2) return _mm256_set1_epi16(static_cast<short>(c));
+			else return _mm256_set1_epi32(static_cast<int>(c));
+		}
+
+		static __m256i equal256(__m256i a, __m256i b) noexcept {
+			if constexpr (sizeof(OutputChar) == 1) return _mm256_cmpeq_epi8(a, b);
+			else if constexpr (sizeof(OutputChar) == 2) return _mm256_cmpeq_epi16(a, b);
+			else return _mm256_cmpeq_epi32(a, b);
+		}
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		static __m128i broadcast128(OutputChar c) noexcept {
+			if constexpr (sizeof(OutputChar) == 1) return _mm_set1_epi8(static_cast<char>(c));
+			else if constexpr (sizeof(OutputChar) == 2) return _mm_set1_epi16(static_cast<short>(c));
+			else return _mm_set1_epi32(static_cast<int>(c));
+		}
+
+		static __m128i equal128(__m128i a, __m128i b) noexcept {
+			if constexpr (sizeof(OutputChar) == 1) return _mm_cmpeq_epi8(a, b);
+			else if constexpr (sizeof(OutputChar) == 2) return _mm_cmpeq_epi16(a, b);
+			else return _mm_cmpeq_epi32(a, b);
+		}
+#endif
+	};
+
+	// Platform-specific console handling.
+	class ConsoleHelper {
+	public:
+		static inline std::unordered_map<wchar_t, std::pair<unsigned short, std::string>> mappings = {
+				{ L'k', { 7, "\33[5m" } }, { L'l', { 7, "\33[21m" } }, { L'm', { 7, "\33[9m" } },
+				{ L'n', { 7, "\33[4m" } }, { L'o', { 7, "\33[3m" } },  { L'r', { 7, "\33[m"} } };
+
+		// Initialize console and check if console supports ANSI escape sequences.
+		static bool initialize() {
+#ifdef _WIN32
+			// If the output is not a terminal, then ANSI sequences are not supported.
+			if (!isAtty) return false;
+
+			RTL_OSVERSIONINFOEXW osInfo{};
+			osInfo.dwOSVersionInfoSize = sizeof(osInfo);
+
+			// Get OS version using RtlGetVersion.
+			// If the call fails or the system is older than Windows 10,
+			// then ANSI sequences are not supported.
+			if (RtlGetVersion(&osInfo) || osInfo.dwMajorVersion < 10) return false;
+
+			unsigned long mode;
+			if (GetConsoleMode(getHandle(), &mode)) {
+				// Enable "virtual terminal processing" in the console mode.
+				// This makes the console recognize ANSI escape sequences.
+				return SetConsoleMode(getHandle(), mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+			}
+
+			// If we cannot get the console mode, assume ANSI is unsupported.
+			return false;
+#else
+			return isAtty;
+#endif
+		}
+
+		// Set the text color for current console output.
+		static void setColor(unsigned short color, const std::string &ansi) {
+			if (!isAtty) return;
+
+			if (ansiSupported) appendAscii(ansi);
+#ifdef _WIN32
+			else SetConsoleTextAttribute(getHandle(), color);
+#endif
+		}
+
+		// Get the text attributes of the current console text.
+		static unsigned short getTextAttribute() {
+#ifdef _WIN32
+			CONSOLE_SCREEN_BUFFER_INFO csbi;
+			return GetConsoleScreenBufferInfo(getHandle(), &csbi) ? csbi.wAttributes : 7;
+#else
+			return 0;
+#endif
+		}
+
+		// Append ASCII text, such as an escape sequence, to the current console line.
+		static void appendAscii(std::string_view text) { lineBuffer.append(text.begin(), text.end()); }
+
+		// Output string to console (ASCII, or UTF-8 text on platforms with UTF-8 output).
+		static void write(std::string_view msg) {
+			if (!isAtty) return;
+
+			lineBuffer.append(msg.begin(), msg.end());
+#ifdef _WIN32
+			if (!ansiSupported) WriteConsoleA(getHandle(), msg.data(), static_cast<unsigned>(msg.length()), nullptr, nullptr);
+#endif
+		}
+
+#ifdef _WIN32
+		// Output wide string to console.
+		static void write(std::wstring_view msg) {
+			if (!isAtty) return;
+
+			if (ansiSupported) lineBuffer += msg;
+			else WriteConsoleW(getHandle(), msg.data(), static_cast<unsigned>(msg.length()), nullptr, nullptr);
+		}
+#endif
+
+		// Move the completed line into the console output buffer.
+		static void flushLine() {
+#ifdef _WIN32
+			if (ansiSupported) {
+				consoleBuffer += lineBuffer;
+				consoleBuffer.push_back(L'\n');
+			} else if (isAtty) WriteConsoleA(getHandle(), "\n", 1, nullptr, nullptr);
+#else
+			if (isAtty) {
+				consoleBuffer += lineBuffer;
+				consoleBuffer.push_back('\n');
+			}
+#endif
+			lineBuffer.clear();
+		}
+
+		// Write all buffered console output with as few calls as possible.
+		static void flushConsole() {
+			if (!streamBuffer.empty()) {
+				writeStderr(streamBuffer);
+				streamBuffer.clear();
+			}
+			if (consoleBuffer.empty()) return;
+#ifdef _WIN32
+			// Older consoles reject very large writes, so output is split into chunks.
+			for (size_t offset = 0; offset < consoleBuffer.length(); offset += 16384) {
+				const auto length = static_cast<unsigned>(std::min<size_t>(16384, consoleBuffer.length() - offset));
+				WriteConsoleW(getHandle(), consoleBuffer.c_str() + offset, length, nullptr, nullptr);
+			}
+#else
+			writeStderr(consoleBuffer);
+#endif
+			consoleBuffer.clear();
+		}
+
+		// Write bytes to stderr as they are, also when it is a pipe or a file, retrying partial writes.
+		static void writeStderr(std::string_view data) {
+			while (!data.empty()) {
+#ifdef _WIN32
+				DWORD written = 0;
+				if (!WriteFile(getHandle(), data.data(), static_cast<DWORD>(std::min<size_t>(data.length(), 1 << 30)), &written, nullptr)) break;
+#else
+				const ssize_t written = ::write(STDERR_FILENO, data.data(), data.length());
+				if (written < 0) {
+					if (errno == EINTR) continue;
+					break;
+				}
+#endif
+				data.remove_prefix(static_cast<size_t>(written));
+			}
+		}
+
+		// Clear remaining content in current line.
+		static void clearLine() {
+			if (!isAtty) return;
+
+			// Clear any remaining text to the right of the cursor.
+			if (ansiSupported) appendAscii("\33[m\33[K");
+#ifdef _WIN32
+			else {
+				// On Windows without ANSI, fill the rest of the line with spaces and reset attributes.
+				SetConsoleTextAttribute(getHandle(), 7);
+				CONSOLE_SCREEN_BUFFER_INFO csbi;
+				if (GetConsoleScreenBufferInfo(getHandle(), &csbi)) {
+					unsigned long length = csbi.dwSize.X - csbi.dwCursorPosition.X;
+					FillConsoleOutputCharacterA(getHandle(), ' ', length, csbi.dwCursorPosition, &length);
+					FillConsoleOutputAttribute(getHandle(), csbi.wAttributes, length, csbi.dwCursorPosition, &length);
+				}
+			}
+#endif
+		}
+
+		// Update dynamic color mappings and find the specified color code.
+		static auto updateMappingsAndFind(const wchar_t code, unsigned short initialColor, const std::string &ansiColor) {
+			const unsigned short attribute = getTextAttribute();
 			mappings.at(L'l').first = mappings.at(L'm').first = mappings.at(L'o').first = attribute;
 			mappings.at(L'k').first = attribute | 0x4000;
 			mappings.at(L'n').first = attribute | 0x8000;
@@ -333,301 +1441,3672 @@ private:
 			return mappings.find(code);
 		}
 
-		// Process Minecraft color codes in message text.
-		static std::wstring processColorCodes(std::wstring msg, unsigned short initialColor, const std::string &ansiColor, bool stripMsg) {
-			std::wstring stripped;
-			while (!msg.empty() && msg.back() == L'\247') msg.pop_back();
+		// Append the text of the line starting at `start` without color codes, a '§' right before the end of the line is ignored.
+		// Returns the position of the line break that ended the line, or the message length.
+		static size_t appendPlainLine(OutputView msg, size_t start, OutputString &out) {
+			size_t pos = start;
+			while (true) {
+				const size_t found = TextScanner::findSpecial(msg, pos);
+				out += msg.substr(pos, found - pos);
+				if (found == msg.length() || TextScanner::isLineBreak(msg[found])) return found;
+
+				// Skip the marker and the character after it.
+				const size_t code = found + TextScanner::MARKER_LENGTH;
+				pos = code == msg.length() || TextScanner::isLineBreak(msg[code]) ? code : code + TextScanner::characterLength(msg, code);
+			}
+		}
+
+		// Output message text from `start` up to the next line break in a single forward pass, applying Minecraft color codes.
+		// A '§' right before the end of the line is ignored.
+		// Returns the position of the line break that ended the output, or the message length.
+		static size_t processColorCodes(OutputView msg, size_t start, unsigned short initialColor, const std::string &ansiColor) {
+			size_t pos = start;
+			while (true) {
+				const size_t found = TextScanner::findSpecial(msg, pos);
+				if (found > pos) write(msg.substr(pos, found - pos));
+				if (found == msg.length() || TextScanner::isLineBreak(msg[found])) return found;
+
+				// The character after '§' selects the color or format, only ASCII characters have a meaning.
+				const size_t code = found + TextScanner::MARKER_LENGTH;
+				if (code == msg.length() || TextScanner::isLineBreak(msg[code])) pos = code;
+				else {
+					if (isAtty) applyMinecraftColorCode(static_cast<wchar_t>(msg[code]), initialColor, ansiColor);
+					pos = code + TextScanner::characterLength(msg, code);
+				}
+			}
+		}
+
+		// Set console text color and style based on a Minecraft-style color code.
+		static void applyMinecraftColorCode(wchar_t code, unsigned short initialColor, const std::string &ansiColor) {
+			// For color codes that only change the text color, use the special mapping.
+			if (L'0' <= code && code <= L'9') setColor(code - L'0', mcToAnsiEscape[code - L'0']);
+			else if (L'a' <= code && code <= L'f') setColor(code - L'W', mcToAnsiEscape[code - L'W']);
+			// For formatting codes, use a temporary specific mapping.
+			else {
+				auto it = updateMappingsAndFind(code, initialColor, ansiColor);
+				if (it != mappings.end()) setColor(it->second.first, it->second.second);
+			}
+		}
+
+#ifdef _WIN32
+		// Get Windows stderr handle with optional caching.
+		static HANDLE getHandle() {
+#ifndef KLY_LOGGER_OPTION_NO_CACHE_FOR_OUTPUT_HANDLE
+			// In cache mode, no need to retrieve stderr handle each time.
+			static
+#endif
+			// In no-cache mode, retrieve the stderr handle on each output.
+			const HANDLE handle = GetStdHandle(STD_ERROR_HANDLE);
+			return handle;
+		}
+#endif
+	};
+
+#if defined(KLY_LOGGER_OPTION_MMAP_LOG_FILE) && !defined(_WIN32)
+	// Log file that is preallocated in fixed-size segments and appended to by copying into a shared mapping.
+	// Copied bytes are in the page cache right away, so they survive a crash of the process without any write call.
+	class MappedFile {
+		static constexpr size_t SEGMENT_SIZE = KLY_LOGGER_OPTION_MMAP_SEGMENT_SIZE;
+
+		int descriptor;
+		char *mapping;
+		size_t capacity, length;
+
+	public:
+		MappedFile() noexcept : descriptor(-1), mapping(nullptr), capacity(0), length(0) {}
+
+		// Create or truncate the file and map its first segment.
+		explicit MappedFile(const std::filesystem::path &path) :
+			descriptor(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)), mapping(nullptr), capacity(0), length(0) {
+			if (descriptor >= 0 && !reserve(SEGMENT_SIZE)) close();
+		}
+
+		MappedFile(MappedFile &&other) noexcept :
+			descriptor(std::exchange(other.descriptor, -1)), mapping(std::exchange(other.mapping, nullptr)),
+			capacity(std::exchange(other.capacity, 0)), length(std::exchange(other.length, 0)) {}
+
+		MappedFile &operator=(MappedFile &&other) noexcept {
+			if (this != &other) {
+				close();
+				descriptor = std::exchange(other.descriptor, -1);
+				mapping = std::exchange(other.mapping, nullptr);
+				capacity = std::exchange(other.capacity, 0);
+				length = std::exchange(other.length, 0);
+			}
+			return *this;
+		}
+
+		~MappedFile() { close(); }
+
+		[[nodiscard]] bool is_open() const noexcept { return descriptor >= 0; }
+
+		// Append bytes, growing the file by whole segments when the mapping is full.
+		// If the file cannot grow (e.g. the disk is full), it is closed with the data written so far.
+		void write(const char *data, std::streamsize size) {
+			const auto count = static_cast<size_t>(size);
+			if (!is_open()) return;
+			if (length + count > capacity && !reserve(length + count)) {
+				close();
+				return;
+			}
+			std::memcpy(mapping + length, data, count);
+			length += count;
+		}
+
+		// Nothing to do, copied bytes already belong to the file.
+		void flush() noexcept {}
+
+		// Write the copied bytes back to the disk.
+		void sync() noexcept {
+			if (mapping && length) msync(mapping, length, MS_SYNC);
+			if (descriptor >= 0) fsync(descriptor);
+		}
+
+		// Unmap the file and cut off the unused part of the last segment.
+		void close() noexcept {
+			if (mapping) munmap(mapping, capacity);
+			if (descriptor >= 0) {
+				if (ftruncate(descriptor, static_cast<off_t>(length))) {}
+				::close(descriptor);
+			}
+			descriptor = -1;
+			mapping = nullptr;
+			capacity = length = 0;
+		}
+
+		// Remove the zero padding a crashed process left after the data of a mapped log file.
+		static void trimPadding(const std::filesystem::path &path) {
+			const int file = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+			if (file < 0) return;
+
+			struct stat fileStat;
+			if (!fstat(file, &fileStat)) {
+				// Padding never exceeds one segment, so only the end of the file is read.
+				off_t end = fileStat.st_size;
+				const off_t limit = std::max<off_t>(0, end - static_cast<off_t>(SEGMENT_SIZE));
+				char buffer[4096];
+				bool found = false;
+				while (!found && end > limit) {
+					const auto count = static_cast<size_t>(std::min<off_t>(sizeof(buffer), end - limit));
+					if (pread(file, buffer, count, end - static_cast<off_t>(count)) != static_cast<ssize_t>(count)) break;
+					size_t i = count;
+					while (i && !buffer[i - 1]) i--;
+					found = i != 0;
+					end -= static_cast<off_t>(count - i);
+				}
+				if (end != fileStat.st_size && ftruncate(file, end)) {}
+			}
+			::close(file);
+		}
+
+	private:
+		// Grow the file and its mapping to hold at least `required` bytes, rounded up to whole segments.
+		bool reserve(size_t required) {
+			const size_t size = (required + SEGMENT_SIZE - 1) / SEGMENT_SIZE * SEGMENT_SIZE;
+			// Allocate the blocks up front, so a full disk fails here instead of raising SIGBUS on a later copy.
+			if (posix_fallocate(descriptor, 0, static_cast<off_t>(size))) return false;
+
+			void *grown = mapping ? mremap(mapping, capacity, size, MREMAP_MAYMOVE) : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+			if (grown == MAP_FAILED) return false;
+			mapping = static_cast<char *>(grown);
+			capacity = size;
+			return true;
+		}
+	};
+
+	// Log file backend.
+	using LogFile = MappedFile;
+#else
+	// Log file backend.
+	using LogFile = std::ofstream;
+#endif
+
+	// File logging helper.
+	class FileLogger {
+	public:
+#ifdef KLY_LOGGER_OPTION_BINARY_LOG_FILE
+		// Extension of the log file and its backups.
+		static constexpr std::string_view EXTENSION = ".klog";
+#else
+		// Extension of the log file and its backups.
+		static constexpr std::string_view EXTENSION = ".log";
+#endif
+
+		// Initialize file logging system if enabled.
+		static void initialize() {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			logFile = getLogFileHandle();
+			logFileGeneration++;
+#endif
+		}
+
+		// Pack date components into a compact unsigned integer representation.
+		static unsigned packDate(const std::tm &time) { return (time.tm_year << 16) + (time.tm_mon << 8) + time.tm_mday; }
+
+		// Update the log file handle for log rotation, using the cached local time of the current record.
+		// Rotates when the date changes or the file would grow beyond the configured size.
+		static void updateIfNeeded() {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			if (rotationPolicyChanged.load(std::memory_order_relaxed) && rotationPolicyChanged.exchange(false)) requestMaintenance();
+
+			const std::uintmax_t maxBytes = rotateMaxBytes.load(std::memory_order_relaxed);
+			const bool full = maxBytes && logFile.is_open() && logFileSize + fileBuffer.size() >= maxBytes;
+			if (full || packDate(cachedLocalTime) != logFileCreateDate) {
+				const auto start = std::chrono::steady_clock::now();
+				// Opening the first file, e.g. by the writer of a shared ring, is not a rotation.
+				const bool rotating = logFileCreateDate != 0;
+				if (logFile.is_open()) {
+					flush();
+					logFile.close();
+				}
+				initialize();
+				if (!rotating) return;
+				increase(rotationCount, 1);
+				increase(rotationNanoseconds, static_cast<std::uint64_t>((std::chrono::steady_clock::now() - start).count()));
+			}
+#endif
+		}
+
+		// Write buffered log file content in a single call.
+		static void flush() {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			if (!fileBuffer.empty() && logFile.is_open()) {
+				logFile.write(fileBuffer.data(), static_cast<std::streamsize>(fileBuffer.size()));
+				logFile.flush();
+				logFileSize += fileBuffer.size();
+			}
+			fileBuffer.clear();
+#endif
+		}
+
+		// Write buffered log file content and ask the operating system to store the log file on disk.
+		static void sync() {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			flush();
+			if (!logFile.is_open()) return;
+#if defined(KLY_LOGGER_OPTION_MMAP_LOG_FILE) && !defined(_WIN32)
+			logFile.sync();
+#elif defined(_WIN32)
+			// The stream does not expose its handle, flushing another handle of the file stores the same data.
+			const HANDLE file = CreateFileW(latestLog.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+					FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file != INVALID_HANDLE_VALUE) {
+				FlushFileBuffers(file);
+				CloseHandle(file);
+			}
+#else
+			// The stream does not expose its descriptor, syncing another descriptor of the file stores the same data.
+			const int file = ::open(latestLog.c_str(), O_RDONLY | O_CLOEXEC);
+			if (file >= 0) {
+				if (fsync(file)) {}
+				::close(file);
+			}
+#endif
+#endif
+		}
+
+		// Get the absolute path of the current executable.
+		static std::filesystem::path getExecutablePath() {
+#ifdef _WIN32
+			// Get executable path on Windows.
+			wchar_t path[5120];
+			GetModuleFileNameW(nullptr, path, 5120);
+#else
+			// Get executable path on Linux.
+			char path[5120];
+			const ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+			if (len == -1) return {};
+			path[len] = 0;
+#endif
+			return path;
+		}
+
+		// Retrieve the current log file handle, creating directories and rotating logs if needed.
+		static LogFile getLogFileHandle() {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			try {
+				// Initialize logs directory and latest log file path if empty.
+				if (logsDirectory.empty() || latestLog.empty()) {
+					logsDirectory = getExecutablePath().parent_path() / "logs";
+					latestLog = logsDirectory / std::string("latest").append(EXTENSION);
+				}
+
+				// Ensure log directory exists.
+				std::filesystem::create_directories(logsDirectory);
+				const std::tm time = TimeUtils::getLocalTime();
+				// Rename existing log file if present.
+				rotateLogFiles(time);
+				logFileCreateDate = packDate(time);
+				logFileSize = 0;
+#if defined(KLY_LOGGER_OPTION_MMAP_LOG_FILE) && !defined(_WIN32)
+				return MappedFile(latestLog);
+#else
+				return std::ofstream(latestLog, std::ios::out | std::ios::trunc | std::ios::binary);
+#endif
+			} catch (...) {
+				// Disable log file if any exception occurs.
+				return {};
+			}
+#else
+			return {};
+#endif
+		}
+
+		// Rename the existing latest.log to a dated backup file with the format YYYY-MM-DD-N.log (.klog for binary log files),
+		// then let the maintenance worker compress it and apply the retention limits.
+		static void rotateLogFiles(const std::tm &time) {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			if (!std::filesystem::exists(latestLog)) return;
+#if defined(KLY_LOGGER_OPTION_MMAP_LOG_FILE) && !defined(_WIN32) && !defined(KLY_LOGGER_OPTION_BINARY_LOG_FILE)
+			// Binary data may end with zero bytes, there the decoder stops at the padding instead.
+			MappedFile::trimPadding(latestLog);
+#endif
+
+			std::tm fileTime{};
+			struct stat fileStat;
+			if (stat(latestLog.string().c_str(), &fileStat)) fileTime = time;
+#ifdef _WIN32
+			else localtime_s(&fileTime, &fileStat.st_mtime);
+#else
+			else localtime_r(&fileStat.st_mtime, &fileTime);
+#endif
+			// The first free index of a date is found with a single directory scan, later rotations on that date count up.
+			const unsigned date = (fileTime.tm_year + 1900) * 10000 + (fileTime.tm_mon + 1) * 100 + fileTime.tm_mday;
+			if (date != backupDate) {
+				backupDate = date;
+				nextBackupIndex = findLastBackupIndex(date) + 1;
+			}
+
+			// Skip names taken in the meantime, e.g. by another process writing to the same directory.
+			std::filesystem::path backup, compressed;
+			do {
+				backup = logsDirectory / std::format("{:04}-{:02}-{:02}-{}{}", fileTime.tm_year + 1900, fileTime.tm_mon + 1, fileTime.tm_mday, nextBackupIndex++, EXTENSION);
+				compressed = backup;
+				compressed += ".gz";
+			} while (std::filesystem::exists(backup) || std::filesystem::exists(compressed));
+
+			std::filesystem::rename(latestLog, backup);
+			requestMaintenance();
+#endif
+		}
+
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+		// Parse a backup file name of the form YYYY-MM-DD-N.log or YYYY-MM-DD-N.log.gz (.klog for binary log files) into its date (YYYYMMDD) and index.
+		static std::optional<std::pair<unsigned, unsigned>> parseBackupName(const std::string &name) {
+			unsigned year, month, day, index;
+			int length = 0;
+			if (std::sscanf(name.c_str(), "%4u-%2u-%2u-%u%n", &year, &month, &day, &index, &length) != 4) return std::nullopt;
+			const std::string_view suffix = std::string_view(name).substr(static_cast<size_t>(length));
+			if (!suffix.starts_with(EXTENSION) || (suffix.length() != EXTENSION.length() && suffix.substr(EXTENSION.length()) != ".gz")) return std::nullopt;
+			return std::pair{year * 10000 + month * 100 + day, index};
+		}
+
+		// Highest index of the backups of a date, or zero if there are none.
+		static unsigned findLastBackupIndex(unsigned date) {
+			unsigned last = 0;
+			for (const auto &file : std::filesystem::directory_iterator(logsDirectory)) {
+				const auto parsed = parseBackupName(file.path().filename().string());
+				if (parsed && parsed->first == date) last = std::max(last, parsed->second);
+			}
+			return last;
+		}
+
+		// Ask the maintenance worker to process the backups, starting it on first use.
+		static void requestMaintenance() {
+#ifndef KLY_LOGGER_OPTION_GZIP
+			// Without compression there is only work to do when a retention limit is set.
+			if (!retainMaxFiles.load(std::memory_order_relaxed) && !retainMaxBytes.load(std::memory_order_relaxed)) return;
+#endif
+			maintenanceRequested.store(true);
+			if (!maintenanceStarted.exchange(true)) maintenanceThread = std::thread(maintenanceLoop);
+			else maintenanceNotifier.notify();
+		}
+
+		// Body of the maintenance worker, which runs at the lowest priority so that it never competes with logging.
+		// Exits when shutdown() asks for it, leaving the backups it has not processed yet for the next run.
+		static void maintenanceLoop() {
+			setLowestThreadPriority();
+			while (!maintenanceStopping.load()) {
+				maintenanceNotifier.waitUntil([] { return maintenanceRequested.load() || maintenanceStopping.load(); }, -1ns);
+				if (maintenanceRequested.exchange(false)) maintainBackups();
+			}
+			maintenanceExited.store(true, std::memory_order_release);
+			maintenanceNotifier.notify();
+		}
+
+		// Compress rotated log files and delete the oldest ones beyond the retention limits (maintenance worker only).
+		static void maintainBackups() {
+			try {
+				struct Backup {
+					std::uint64_t order;
+					std::filesystem::path path;
+					std::uintmax_t size;
+				};
+				std::vector<Backup> backups;
+				for (const auto &file : std::filesystem::directory_iterator(logsDirectory)) {
+					const std::string name = file.path().filename().string();
+#ifdef KLY_LOGGER_OPTION_GZIP
+					// Partial archives are left over from a run that crashed, this worker writes only one at a time.
+					if (name.ends_with(".part") && parseBackupName(name.substr(0, name.length() - 5))) {
+						std::error_code error;
+						std::filesystem::remove(file.path(), error);
+						continue;
+					}
+#endif
+					const auto parsed = parseBackupName(name);
+					if (!parsed || !file.is_regular_file()) continue;
+#ifdef KLY_LOGGER_OPTION_GZIP
+					// A compressed copy next to its source is left over from an interrupted run and is written again.
+					if (file.path().extension() == ".gz" && std::filesystem::exists(file.path().parent_path() / file.path().stem())) continue;
+#endif
+					backups.push_back({static_cast<std::uint64_t>(parsed->first) << 32 | parsed->second, file.path(), file.file_size()});
+				}
+
+#ifdef KLY_LOGGER_OPTION_GZIP
+				for (Backup &backup : backups) {
+					if (maintenanceStopping.load(std::memory_order_relaxed)) return;
+					if (backup.path.extension() != EXTENSION) continue;
+					std::filesystem::path compressed = backup.path;
+					compressed += ".gz";
+					if (!compressFile(backup.path, compressed)) continue;
+					std::filesystem::remove(backup.path);
+					backup.path = std::move(compressed);
+					backup.size = std::filesystem::file_size(backup.path);
+				}
+#endif
+
+				// Delete from the oldest backup until both limits are met.
+				const size_t maxFiles = retainMaxFiles.load(std::memory_order_relaxed);
+				const std::uintmax_t maxBytes = retainMaxBytes.load(std::memory_order_relaxed);
+				std::sort(backups.begin(), backups.end(), [](const Backup &a, const Backup &b) { return a.order < b.order; });
+				size_t count = backups.size();
+				std::uintmax_t total = 0;
+				for (const Backup &backup : backups) total += backup.size;
+				for (const Backup &backup : backups) {
+					if ((!maxFiles || count <= maxFiles) && (!maxBytes || total <= maxBytes)) break;
+					std::error_code error;
+					if (!std::filesystem::remove(backup.path, error)) continue;
+					count--;
+					total -= backup.size;
+				}
+			} catch (...) {
+				// Try again with the next rotation.
+			}
+		}
+
+#ifdef KLY_LOGGER_OPTION_GZIP
+		// Write a gzip copy of a file, through a temporary file so that an interrupted run never leaves a truncated archive.
+		// Gives up when shutdown() stops the maintenance worker, the next run compresses the file again.
+		static bool compressFile(const std::filesystem::path &source, const std::filesystem::path &target) {
+			std::ifstream input(source, std::ios::binary);
+			if (!input) return false;
+
+			std::filesystem::path partial = target;
+			partial += ".part";
+#ifdef _WIN32
+			const gzFile output = gzopen_w(partial.c_str(), "wb");
+#else
+			const gzFile output = gzopen(partial.c_str(), "wb");
+#endif
+			std::error_code error;
+			if (!output) {
+				std::filesystem::remove(partial, error);
+				return false;
+			}
+
+			static char buffer[1 << 16];
+			bool succeeded = true;
+			while (succeeded && !maintenanceStopping.load(std::memory_order_relaxed) && input.read(buffer, sizeof(buffer)).gcount() > 0) {
+				const auto count = static_cast<unsigned>(input.gcount());
+				succeeded = gzwrite(output, buffer, count) == static_cast<int>(count);
+			}
+			succeeded = gzclose(output) == Z_OK && succeeded && !input.bad() && !maintenanceStopping.load(std::memory_order_relaxed);
+
+			if (succeeded) std::filesystem::rename(partial, target, error);
+			if (!succeeded || error) {
+				std::filesystem::remove(partial, error);
+				return false;
+			}
+			return true;
+		}
+#endif
+#endif
+	};
+
+	// Time utilities.
+	class TimeUtils {
+	public:
+		// Retrieve the current local time.
+		static std::tm getLocalTime() { return toLocalTime(time(nullptr)); }
+
+		// Convert seconds since the Unix epoch to local time.
+		static std::tm toLocalTime(const time_t seconds) {
+			std::tm result{};
+#ifdef _WIN32
+			localtime_s(&result, &seconds);
+#else
+			localtime_r(&seconds, &result);
+#endif
+			return result;
+		}
+
+		// Current wall-clock time in nanoseconds since the Unix epoch, read from the cheaper monotonic clock.
+		static std::int64_t now() noexcept {
+			const auto monotonic = std::chrono::steady_clock::now().time_since_epoch();
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(monotonic).count() + clockOffset.load(std::memory_order_relaxed);
+		}
+
+		// Difference between the wall clock and the monotonic clock in nanoseconds.
+		static std::int64_t measureClockOffset() noexcept {
+			const auto wall = std::chrono::system_clock::now().time_since_epoch();
+			const auto monotonic = std::chrono::steady_clock::now().time_since_epoch();
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(wall - monotonic).count();
+		}
+
+		// Refresh the cached local time when a timestamp falls into a new second (logging thread only).
+		static void updateCache(const std::int64_t timestamp) {
+			const std::int64_t second = timestamp / 1000000000 - (timestamp % 1000000000 < 0);
+			if (second == cachedSecond) return;
+
+			cachedSecond = second;
+			cachedLocalTime = toLocalTime(static_cast<time_t>(second));
+			cachedTimeText = std::format("{:02}:{:02}:{:02}", cachedLocalTime.tm_hour, cachedLocalTime.tm_min, cachedLocalTime.tm_sec);
+#ifndef KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER
+			FlightRecorder::utcOffset.store(toEpochSeconds(cachedLocalTime) - second, std::memory_order_relaxed);
+#endif
+
+			// Re-align the monotonic clock with the wall clock once a minute.
+			if (second >= nextClockCalibration) {
+				clockOffset.store(measureClockOffset(), std::memory_order_relaxed);
+				nextClockCalibration = second + 60;
+			}
+		}
+
+		// Format a timestamp to %H:%M:%S string with the configured fraction of a second.
+		static std::string formatTime(const std::int64_t timestamp) {
+			updateCache(timestamp);
+			std::string result = cachedTimeText;
+			appendFraction(result, timestamp - cachedSecond * 1000000000, timePrecision.load(std::memory_order_relaxed));
+			result.push_back(' ');
+			return result;
+		}
+
+		// Format a timestamp like formatTime(), for a given offset of local time from UTC in seconds and a given precision.
+		static std::string formatTime(const std::int64_t timestamp, const std::int64_t utcOffset, const TimePrecision precision) {
+			const std::int64_t second = timestamp / 1000000000 - (timestamp % 1000000000 < 0);
+			const std::int64_t secondOfDay = ((second + utcOffset) % 86400 + 86400) % 86400;
+			std::string result = std::format("{:02}:{:02}:{:02}", secondOfDay / 3600, secondOfDay / 60 % 60, secondOfDay % 60);
+			appendFraction(result, timestamp - second * 1000000000, precision);
+			result.push_back(' ');
+			return result;
+		}
+
+		// Append a timestamp as an ISO 8601 date and time in UTC with at least milliseconds, e.g. 2025-01-01T12:34:56.789Z.
+		static void appendIsoTime(std::string &out, const std::int64_t timestamp) {
+			const std::int64_t second = timestamp / 1000000000 - (timestamp % 1000000000 < 0);
+			const std::int64_t day = second / 86400 - (second % 86400 < 0), secondOfDay = second - day * 86400;
+			// Civil date of a day since the Unix epoch, the inverse of toEpochSeconds().
+			const std::int64_t shifted = day + 719468, era = (shifted >= 0 ? shifted : shifted - 146096) / 146097, dayOfEra = shifted - era * 146097;
+			const std::int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+			const std::int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100), shiftedMonth = (5 * dayOfYear + 2) / 153;
+			const std::int64_t month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9, year = yearOfEra + era * 400 + (month <= 2);
+			std::format_to(std::back_inserter(out), "{:04}-{:02}-{:02}T{:02}:{:02}:{:02}", year, month, dayOfYear - (153 * shiftedMonth + 2) / 5 + 1,
+					secondOfDay / 3600, secondOfDay / 60 % 60, secondOfDay % 60);
+			const bool micro = timePrecision.load(std::memory_order_relaxed) == TimePrecision::Microseconds;
+			appendFraction(out, timestamp - second * 1000000000, micro ? TimePrecision::Microseconds : TimePrecision::Milliseconds);
+			out.push_back('Z');
+		}
+
+		// Append the fraction of a second (in nanoseconds) shown for a precision.
+		static void appendFraction(std::string &result, const std::int64_t fraction, const TimePrecision precision) {
+			if (precision == TimePrecision::Seconds) return;
+			const int digits = precision == TimePrecision::Milliseconds ? 3 : 6;
+			auto value = fraction / (precision == TimePrecision::Milliseconds ? 1000000 : 1000);
+			result.resize(result.length() + digits + 1);
+			for (int i = 0; i < digits; i++, value /= 10) result[result.length() - 1 - i] = static_cast<char>('0' + value % 10);
+			result[result.length() - digits - 1] = '.';
+		}
+
+		// Seconds since the Unix epoch of a broken-down time read as UTC, so that subtracting the actual time of
+		// a local time yields the offset of the time zone.
+		static std::int64_t toEpochSeconds(const std::tm &time) noexcept {
+			const std::int64_t month = time.tm_mon + 1, year = time.tm_year + 1900 - (month <= 2);
+			const std::int64_t era = (year >= 0 ? year : year - 399) / 400, yearOfEra = year - era * 400;
+			const std::int64_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + time.tm_mday - 1;
+			const std::int64_t days = era * 146097 + yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear - 719468;
+			return days * 86400 + time.tm_hour * 3600 + time.tm_min * 60 + time.tm_sec;
+		}
+	};
+
+	// Log message processor.
+	class MessageProcessor {
+	public:
+		// Call `processLine(start)` for every line of a message, which returns the position of the line break that ended the line.
+		// Empty lines are skipped.
+		template<typename LineProcessor>
+		static void forEachLine(OutputView message, LineProcessor &&processLine) {
+			size_t lineStart = 0;
+			while (lineStart < message.length()) {
+				if (TextScanner::isLineBreak(message[lineStart])) lineStart++;
+				else lineStart = processLine(lineStart) + 1;
+			}
+		}
+
+		// Output a complete log message to the console, with the header in front of every line.
+		static void printMessage(LoggerEntry &logger, OutputView message, const LogStyle &style, std::int64_t timestamp) {
+			forEachLine(message, [&](size_t start) { return printLine(logger, message, start, style, timestamp); });
+		}
+
+		// Output the line of a log message starting at `start` to the console with formatting.
+		// Returns the position of the line break that ended it, or the message length.
+		static size_t printLine(LoggerEntry &logger, OutputView message, size_t start, const LogStyle &style, std::int64_t timestamp) {
+			callBeforeLog();
+			printTimeStamp(logger, style, timestamp);
+			const size_t end = ConsoleHelper::processColorCodes(message, start, style.textColor, style.textAnsiColor);
+			ConsoleHelper::clearLine();
+			ConsoleHelper::flushLine();
+			return end;
+		}
+
+		// Call the function registered with setBeforeLog(), if any.
+		static void callBeforeLog() {
+			if (!beforeLog) return;
+			const auto start = std::chrono::steady_clock::now();
+			try {
+				beforeLog();
+			} catch (...) {
+			}
+			callbackNanoseconds.fetch_add(static_cast<std::uint64_t>((std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+		}
+
+		// Append a complete log message to the stream buffer in a StreamFormat other than None, calling setBeforeLog() functions once.
+		static void writeStreamMessage(LoggerEntry &logger, OutputView message, const LogStyle &style, std::int64_t timestamp, std::string_view fields,
+				StreamFormat format) {
+			callBeforeLog();
+			if (!logger.streamRendered) {
+				const std::string name = plainName(logger.outputName);
+				for (const LogStyle *each : LOG_STYLES) logger.streamHeaders[static_cast<size_t>(each->severity)] = renderFileHeader(name, *each);
+				appendJsonString(logger.streamName, name);
+				logger.streamRendered = true;
+			}
+
+			if (format == StreamFormat::Plain) appendFileLines(streamBuffer, TimeUtils::formatTime(timestamp), logger.streamHeaders[static_cast<size_t>(style.severity)], message, fields, "[");
+			else appendJsonRecord(streamBuffer, logger.streamName, message, style, timestamp, fields);
+		}
+
+		// Append a record as a JSON object on a line of its own, given the logger name as a JSON string. Fields follow the message.
+		static void appendJsonRecord(std::string &out, const std::string &name, OutputView message, const LogStyle &style, std::int64_t timestamp, std::string_view fields) {
+			// The lines of the message without color codes, joined by line breaks. File and console sinks may run on different threads.
+			static thread_local OutputString plainText;
+			plainText.clear();
+			forEachLine(message, [&](size_t start) {
+				if (!plainText.empty()) plainText.push_back('\n');
+				return ConsoleHelper::appendPlainLine(message, start, plainText);
+			});
+			out += "{\"time\":\"";
+			TimeUtils::appendIsoTime(out, timestamp);
+			out += "\",\"level\":\"";
+			out += style.level;
+			out += "\",\"logger\":";
+			out += name;
+			out += ",\"message\":";
+#ifdef _WIN32
+			appendJsonString(out, StringConverter::toUtf8(plainText));
+#else
+			appendJsonString(out, plainText);
+#endif
+			FieldCodec::appendJson(out, fields);
+			out += "}\n";
+		}
+
+		// Append UTF-8 text as a JSON string literal, escaping quotes, backslashes and control characters.
+		// Invalid UTF-8 sequences are replaced with U+FFFD, so the output stays valid JSON.
+		static void appendJsonString(std::string &out, std::string_view text) {
+			out.push_back('"');
+			const auto *data = reinterpret_cast<const unsigned char *>(text.data());
+			size_t start = 0;
+			for (size_t i = 0; i < text.length(); i++) {
+				const auto c = static_cast<unsigned char>(text[i]);
+				if (c >= 0x80) {
+					const size_t lead = i;
+					bool valid = true;
+					StringConverter::decodeUtf8(data, text.length(), i, valid);
+					if (valid) {
+						i--;
+						continue;
+					}
+					out.append(text.data() + start, lead - start);
+					out += "\xEF\xBF\xBD";
+					start = i--;
+					continue;
+				}
+				if (c >= 0x20 && c != '"' && c != '\\') continue;
+				out.append(text.data() + start, i - start);
+				start = i + 1;
+				if (c == '"' || c == '\\') {
+					out.push_back('\\');
+					out.push_back(static_cast<char>(c));
+				} else if (c == '\n') out += "\\n";
+				else if (c == '\r') out += "\\r";
+				else if (c == '\t') out += "\\t";
+				else std::format_to(std::back_inserter(out), "\\u{:04x}", c);
+			}
+			out.append(text.data() + start, text.length() - start);
+			out.push_back('"');
+		}
+
+		// Print the time of the log call and logger name (if provided).
+		static void printTimeStamp(LoggerEntry &logger, const LogStyle &style, std::int64_t timestamp) {
+			if (!isAtty) return;
+			const std::string time = TimeUtils::formatTime(timestamp);
+
+			// Unless a legacy Windows console needs color calls, the header is copied from pre-rendered fragments.
+			if (ansiSupported) {
+				if (!logger.consoleRendered) renderConsoleHeaders(logger);
+				ConsoleHelper::appendAscii(ANSI_HEADER_PREFIX);
+				ConsoleHelper::appendAscii(time);
+				lineBuffer += logger.consoleHeaders[static_cast<size_t>(style.severity)];
+				return;
+			}
+
+			// Set cyan color for timestamp bracket if output is terminal.
+			ConsoleHelper::setColor(3, "\33[0;36m");
+			ConsoleHelper::write("\r[");
+			ConsoleHelper::setColor(3, "\33[0;36m");
+			// Write formatted time (HH:MM:SS with optional fraction).
+			ConsoleHelper::write(time);
+			printHeaderSuffix(logger.outputName, style);
+		}
+
+		// Render the console headers of every level for a logger once, reusing the regular output routines.
+		static void renderConsoleHeaders(LoggerEntry &logger) {
+			OutputString savedLine = std::move(lineBuffer);
+			for (const LogStyle *style : LOG_STYLES) {
+				lineBuffer.clear();
+				printHeaderSuffix(logger.outputName, *style);
+				logger.consoleHeaders[static_cast<size_t>(style->severity)] = lineBuffer;
+			}
+			lineBuffer = std::move(savedLine);
+			logger.consoleRendered = true;
+		}
+
+		// Print the part of the header after the time: level, logger name and the message color.
+		static void printHeaderSuffix(OutputView name, const LogStyle &style) {
+			// Set level-specific color for level text.
+			ConsoleHelper::setColor(style.levelColor, style.levelAnsiColor);
+			ConsoleHelper::write(style.level);
+			// Reset to cyan for closing bracket.
+			ConsoleHelper::setColor(3, "\33[0;36m");
+			ConsoleHelper::write("] ");
+
+			// Add logger name section if name is not empty.
+			if (!name.empty()) {
+				ConsoleHelper::write("[");
+				// Process color codes in logger name.
+				ConsoleHelper::processColorCodes(name, 0, 3, "\33[0;36m");
+				ConsoleHelper::setColor(3, "\33[0;36m");
+				ConsoleHelper::write("] ");
+			}
+
+			// Set final text color for the actual log message.
+			ConsoleHelper::setColor(style.textColor, style.textAnsiColor);
+		}
+
+		// Append a complete log message to the log file buffer as plain UTF-8 text, with the header in front of every line.
+		static void writeFileMessage([[maybe_unused]] LoggerEntry &logger, [[maybe_unused]] OutputView message, [[maybe_unused]] const LogStyle &style,
+				[[maybe_unused]] std::int64_t timestamp, [[maybe_unused]] std::string_view fields) {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			if (!logger.fileRendered) renderFileHeaders(logger);
+			if (fieldFormat.load(std::memory_order_relaxed) == FieldFormat::JsonLines) appendJsonRecord(fileBuffer, logger.fileJsonName, message, style, timestamp, fields);
+			else appendFileLines(fileBuffer, TimeUtils::formatTime(timestamp), logger.fileHeaders[static_cast<size_t>(style.severity)], message, fields);
+#endif
+		}
+
+		// Append the lines of a message in the plain-text form of the log file, given the time and the header after it.
+		// Fields follow the last line as logfmt pairs.
+		static void appendFileLines(std::string &out, const std::string &time, const std::string &header, OutputView message, std::string_view fields = {},
+				std::string_view lineStart = "\r[") {
+#ifdef _WIN32
+			OutputString line;
+#endif
+			const size_t begin = out.size();
+			forEachLine(message, [&](size_t start) {
+				out += lineStart;
+				out += time;
+				out += header;
+#ifdef _WIN32
+				line.clear();
+				const size_t end = ConsoleHelper::appendPlainLine(message, start, line);
+				StringConverter::appendUtf8(out, line);
+#else
+				const size_t end = ConsoleHelper::appendPlainLine(message, start, out);
+#endif
+				out.push_back('\n');
+				return end;
+			});
+			if (fields.empty()) return;
+			if (out.size() == begin) {
+				// A message without lines still gets its header, so the fields have a record to belong to.
+				out += lineStart;
+				out += time;
+				out += header;
+				const size_t pairs = out.size();
+				FieldCodec::appendLogfmt(out, fields);
+				out.erase(pairs, 1);
+			} else {
+				out.pop_back();
+				FieldCodec::appendLogfmt(out, fields);
+			}
+			out.push_back('\n');
+		}
+
+		// Render the file headers of every level for a logger once.
+		static void renderFileHeaders(LoggerEntry &logger) {
+			const std::string name = plainName(logger.outputName);
+			for (const LogStyle *style : LOG_STYLES) logger.fileHeaders[static_cast<size_t>(style->severity)] = renderFileHeader(name, *style);
+			appendJsonString(logger.fileJsonName, name);
+			logger.fileRendered = true;
+		}
+
+		// Logger name without color codes, as UTF-8.
+		static std::string plainName(OutputView name) {
+			OutputString stripped;
+			ConsoleHelper::appendPlainLine(name, 0, stripped);
+			return StringConverter::toUtf8(stripped);
+		}
+
+		// File header after the time: level and logger name.
+		static std::string renderFileHeader(const std::string &name, const LogStyle &style) {
+			std::string header = style.level + "] ";
+			if (!name.empty()) header += '[' + name + "] ";
+			return header;
+		}
+	};
+
+	// Find the registry entry for a logger name, adding it if it does not exist yet (lock-free).
+	static LoggerEntry *internLoggerName(const std::wstring &name) {
+		LoggerEntry *head = loggerRegistry.load(std::memory_order_acquire), *created = nullptr;
+		while (true) {
+			for (LoggerEntry *entry = head; entry; entry = entry->next) {
+				if (entry->name == name) {
+					delete created;
+					return entry;
+				}
+			}
+
+			if (!created) created = new LoggerEntry{name, StringConverter::toOutput(name)};
+			created->next = head;
+			if (loggerRegistry.compare_exchange_weak(head, created, std::memory_order_release, std::memory_order_acquire)) return created;
+		}
+	}
+
+	// Set the current thread to the lowest priority.
+	static void setLowestThreadPriority() noexcept {
+#ifdef _WIN32
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#else
+		setpriority(PRIO_PROCESS, gettid(), 19);
+#endif
+	}
+
+	// Hint the CPU that the current thread is busy-waiting.
+	static void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+		_mm_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+public:
+	// Behavior of a log call when the log queue is full.
+	enum class OverflowPolicy : unsigned char {
+		// Wait until the logging thread frees a slot.
+		Block,
+		// Discard the record being logged.
+		DropNewest,
+		// Discard the oldest queued record to make room for the new one.
+		OverwriteOldest
+	};
+
+	// Controls when buffered output is written to the console and log file.
+	struct FlushPolicy {
+		// Write buffered output once it grows beyond this many bytes.
+		size_t maxBufferedBytes = 64 * 1024;
+		// Longest time output may stay buffered, zero writes it as soon as the queue has been drained.
+		std::chrono::milliseconds maxDelay = 0ms;
+		// Write buffered output right after every ERROR or FATAL record.
+		bool immediateOnError = true;
+	};
+
+	// Interval of the *Every() log functions. Converting the interval to it records the call site it is written at.
+	struct Every {
+		size_t interval;
+		std::source_location site;
+
+		Every(size_t interval, std::source_location site = std::source_location::current()) noexcept : interval(interval), site(site) {}
+	};
+
+	// Structured field of a log call, created with kv(). It refers to the value, which is only read during the call.
+	template<typename Key, typename Value>
+	struct KeyValue {
+		Key key;
+		const Value &value;
+	};
+
+	// Attach a structured field to a log call, after the format arguments: logger.info("Request done", KlyLogger::kv("ms", 12)).
+	// Numbers, booleans and strings keep their type, other values are stored as their std::format() text.
+	template<typename Value>
+	static KeyValue<std::string_view, Value> kv(std::string_view key, const Value &value) noexcept { return {key, value}; }
+
+	template<typename Value>
+	static KeyValue<std::wstring_view, Value> kv(std::wstring_view key, const Value &value) noexcept { return {key, value}; }
+
+	// Mark a format as a string literal: logger.info(KlyLogger::literal("Loaded {} entries"), count). Such formats are kept as a pointer
+	// instead of being copied by deferred formatting, and can be rate limited, recorded by the flight recorder and interned by the binary log.
+	// Only arrays with static storage compile, an array on the stack of the caller is rejected at compile time.
+	template<typename Char, size_t N> requires std::is_same_v<Char, char> || std::is_same_v<Char, wchar_t>
+	static consteval StringConverter::Literal<Char> literal(const Char (&text)[N]) noexcept { return {text}; }
+
+	// Structured field of a log record as passed to callbacks (see kv()).
+	struct LogField {
+		std::wstring key;
+		std::variant<std::int64_t, std::uint64_t, double, bool, std::wstring> value;
+	};
+
+	// Limits how often a single call site may log, to keep error storms from flooding the queue and the outputs.
+	struct RateLimitPolicy {
+		// Records per second each call site (format string literal, level and logger) may log on average, zero disables the limit.
+		// Calls over the limit are discarded before formatting and counted, the count is logged once the storm is over.
+		// FATAL records and messages whose format is not marked with literal() are never limited.
+		double maxRecordsPerSecond = 0;
+		// Records a call site may log at once before the limit applies.
+		size_t burst = 10;
+		// Output a run of identical records (same logger, level and text) once, followed by "Last message repeated N times".
+		bool collapseRepeats = false;
+	};
+
+	// Controls when the log file is rotated and how many rotated files are kept.
+	// Rotated files are compressed to .log.gz when KLY_LOGGER_OPTION_GZIP is defined.
+	struct RotationPolicy {
+		// Rotate latest.log once it grows beyond this many bytes, zero only rotates when the date changes.
+		std::uintmax_t maxFileBytes = 0;
+		// Keep at most this many rotated files, zero keeps all of them.
+		size_t maxBackupFiles = 0;
+		// Keep at most this many bytes of rotated files, zero keeps all of them.
+		std::uintmax_t maxBackupBytes = 0;
+	};
+
+	// Controls how the operating system schedules the logging thread and the writer threads of sinks.
+	// The default runs them at the lowest priority, so that logging never competes with the application.
+	struct SchedulingPolicy {
+		// Linux scheduling policies (SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO and SCHED_RR), ignored on Windows.
+		enum class Class : unsigned char { Normal, Batch, Idle, Fifo, RoundRobin };
+
+		// CPUs the threads may run on, e.g. a housekeeping core, empty allows the CPUs of the process.
+		std::vector<unsigned> cpus;
+		// Nice value from -20 (highest priority) to 19 (lowest), mapped to the closest thread priority on Windows.
+		int niceValue = 19;
+		Class schedulingClass = Class::Normal;
+		// Priority from 1 to 99 for Class::Fifo and Class::RoundRobin.
+		int realtimePriority = 1;
+		// Raise the priority of the logging thread to boostNiceValue (and Class::Normal instead of Batch or Idle) once this
+		// many records are queued or a record waited this long, until the queue has been drained. Zero disables each trigger.
+		// Lowering the nice value needs CAP_SYS_NICE or a matching RLIMIT_NICE on Linux, without it the priority stays as it is.
+		size_t boostQueueDepth = 0;
+		std::chrono::milliseconds boostLag = 0ms;
+		int boostNiceValue = 0;
+	};
+
+	// Binary log file format, written instead of text when KLY_LOGGER_OPTION_BINARY_LOG_FILE is defined, and its decoder.
+	// A file starts with MAGIC followed by entries, each beginning with an Entry tag. The logger names and call sites
+	// (format string, level and logger) are written once per file, records then only hold the call site, the time since
+	// the previous record and the arguments. Records that cannot be encoded this way hold their formatted text instead.
+	// Integers are LEB128 varints (zigzag-encoded if signed), floating-point numbers are little-endian IEEE 754 and
+	// strings are UTF-8 prefixed with their length.
+	class BinaryLog {
+	public:
+		static constexpr std::string_view MAGIC{"KLYLOG\0\1", 8};
+
+		enum class Entry : unsigned char {
+			// Zero bytes at the end, e.g. the unused part of a memory-mapped file after a crash.
+			Padding,
+			// Offset of local time from UTC in seconds, and the TimePrecision of the following records.
+			Clock,
+			// Logger id (counting from 0) and name.
+			Logger,
+			// Call site id (counting from 1), level, logger id and format string.
+			Site,
+			// Call site id, time delta in nanoseconds, argument count and arguments.
+			Record,
+			// Logger id, level, time delta in nanoseconds and formatted text.
+			TextRecord
+		};
+
+		// Type tag in front of every argument, WideString (length in code units, then the raw units) is only used by the flight recorder.
+		enum class Argument : unsigned char { Signed = 1, Unsigned, Float, Double, Character, Boolean, Pointer, String, WideString };
+
+		// Whether a captured argument can be stored in a record and formatted again by the decoder with the same result.
+		template<typename T>
+		static constexpr bool isEncodable = (std::is_arithmetic_v<T> && !std::is_same_v<T, long double>) || std::is_same_v<T, std::string> ||
+				std::is_same_v<T, std::wstring> || std::is_same_v<T, const void *> || std::is_same_v<T, void *>;
+
+		static void putVarint(auto &out, std::uint64_t value) {
+			for (; value >= 0x80; value >>= 7) out.push_back(static_cast<char>(value | 0x80));
+			out.push_back(static_cast<char>(value));
+		}
+
+		static void putSigned(auto &out, std::int64_t value) {
+			putVarint(out, static_cast<std::uint64_t>(value) << 1 ^ static_cast<std::uint64_t>(value >> 63));
+		}
+
+		static void putString(auto &out, std::string_view value) {
+			putVarint(out, value.length());
+			out += value;
+		}
+
+		static void putTag(auto &out, auto tag) { out.push_back(static_cast<char>(tag)); }
+
+		// Append an argument with its type tag, wide characters and strings are stored as UTF-8 text.
+		template<typename T>
+		static void putArgument(auto &out, const T &value) {
+			if constexpr (std::is_same_v<T, bool>) {
+				putTag(out, Argument::Boolean);
+				out.push_back(value);
+			} else if constexpr (std::is_same_v<T, char>) {
+				putTag(out, Argument::Character);
+				out.push_back(value);
+			} else if constexpr (std::is_same_v<T, wchar_t>) {
+				putTag(out, Argument::String);
+				putString(out, StringConverter::toString(std::wstring_view(&value, 1)));
+			} else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+				putTag(out, Argument::Signed);
+				putSigned(out, value);
+			} else if constexpr (std::is_integral_v<T>) {
+				putTag(out, Argument::Unsigned);
+				putVarint(out, value);
+			} else if constexpr (std::is_floating_point_v<T>) {
+				putTag(out, std::is_same_v<T, float> ? Argument::Float : Argument::Double);
+				using Bits = std::conditional_t<std::is_same_v<T, float>, std::uint32_t, std::uint64_t>;
+				const auto bits = std::bit_cast<Bits>(value);
+				for (size_t i = 0; i < sizeof(Bits); i++) out.push_back(static_cast<char>(bits >> i * 8));
+			} else if constexpr (std::is_same_v<T, std::string>) {
+				putTag(out, Argument::String);
+				putString(out, value);
+			} else if constexpr (std::is_same_v<T, std::wstring>) {
+				putTag(out, Argument::String);
+				putString(out, StringConverter::toString(value));
+			} else {
+				putTag(out, Argument::Pointer);
+				putVarint(out, reinterpret_cast<std::uintptr_t>(static_cast<const void *>(value)));
+			}
+		}
+
+		// Walk a format string like std::vformat, passing literal text and every replacement field (argument index and
+		// format spec) to the callbacks. Returns false for what cannot be reproduced field by field: nested replacement fields
+		// (dynamic width or precision), mixed automatic and manual indexing, indices of missing arguments and unmatched braces.
+		template<typename TextCallback, typename FieldCallback>
+		static bool parseFormat(std::string_view format, size_t count, TextCallback &&text, FieldCallback &&field) {
+			size_t next = 0;
+			bool automatic = false, manual = false;
+			for (size_t pos = 0; pos < format.length();) {
+				const size_t brace = format.find_first_of("{}", pos);
+				text(format.substr(pos, brace - pos));
+				if (brace == std::string_view::npos) break;
+				if (brace + 1 < format.length() && format[brace + 1] == format[brace]) {
+					text(format.substr(brace, 1));
+					pos = brace + 2;
+					continue;
+				}
+				if (format[brace] == '}') return false;
+
+				size_t end = brace + 1, index = 0;
+				if (end < format.length() && format[end] >= '0' && format[end] <= '9') {
+					if (automatic || (format[end] == '0' && end + 1 < format.length() && format[end + 1] >= '0' && format[end + 1] <= '9')) return false;
+					manual = true;
+					for (; end < format.length() && format[end] >= '0' && format[end] <= '9' && index <= count; end++) index = index * 10 + (format[end] - '0');
+				} else {
+					if (manual) return false;
+					automatic = true;
+					index = next++;
+				}
+				if (index >= count) return false;
+
+				std::string_view spec;
+				if (end < format.length() && format[end] == ':') {
+					const size_t close = format.find_first_of("{}", end + 1);
+					if (close == std::string_view::npos || format[close] == '{') return false;
+					spec = format.substr(end + 1, close - end - 1);
+					end = close;
+				}
+				if (end >= format.length() || format[end] != '}') return false;
+				field(index, spec);
+				pos = end + 1;
+			}
+			return true;
+		}
+
+		// Convert a binary log file back into the exact text of the log file.
+		// Returns false if the input is not a binary log file or ends in the middle of an entry.
+		static bool decode(std::istream &in, std::ostream &out) {
+			Reader reader(in);
+			std::string magic;
+			if (!reader.bytes(magic, MAGIC.length()) || magic != MAGIC) return false;
+
+			struct Site {
+				const LogStyle *style;
+				size_t logger;
+				std::string format;
+			};
+			std::vector<std::string> loggers;
+			std::vector<Site> sites;
+			std::vector<Value> values;
+			std::int64_t utcOffset = 0, timestamp = 0;
+			TimePrecision precision = TimePrecision::Seconds;
+			std::string text, output;
+
+			unsigned char tag;
+			while (reader.byte(tag)) {
+				std::uint64_t id, logger, count;
+				std::int64_t delta;
+				unsigned char level;
+				switch (static_cast<Entry>(tag)) {
+					case Entry::Padding:
+						return true;
+					case Entry::Clock:
+						if (!reader.signedVarint(utcOffset) || !reader.byte(level) || level > static_cast<unsigned char>(TimePrecision::Microseconds)) return false;
+						precision = static_cast<TimePrecision>(level);
+						break;
+					case Entry::Logger:
+						if (!reader.varint(id) || id != loggers.size() || !reader.string(text)) return false;
+						loggers.push_back(MessageProcessor::plainName(StringConverter::toOutput(text)));
+						break;
+					case Entry::Site:
+						if (!reader.varint(id) || id != sites.size() + 1 || !reader.byte(level) || level >= std::size(LOG_STYLES)) return false;
+						if (!reader.varint(logger) || logger >= loggers.size() || !reader.string(text)) return false;
+						sites.push_back({LOG_STYLES[level], static_cast<size_t>(logger), text});
+						break;
+					case Entry::Record: {
+						if (!reader.varint(id) || !id || id > sites.size() || !reader.signedVarint(delta) || !reader.varint(count)) return false;
+						values.resize(static_cast<size_t>(std::min<std::uint64_t>(count, 1024)));
+						if (values.size() != count) return false;
+						for (Value &value : values) {
+							if (!readArgument(reader, value)) return false;
+						}
+						const Site &site = sites[id - 1];
+						timestamp += delta;
+						text = formatArguments(site.format, values);
+						appendRecord(output, timestamp, utcOffset, precision, *site.style, loggers[site.logger], text);
+						break;
+					}
+					case Entry::TextRecord:
+						if (!reader.varint(logger) || logger >= loggers.size() || !reader.byte(level) || level >= std::size(LOG_STYLES)) return false;
+						if (!reader.signedVarint(delta) || !reader.string(text)) return false;
+						timestamp += delta;
+						appendRecord(output, timestamp, utcOffset, precision, *LOG_STYLES[level], loggers[logger], text);
+						break;
+					default:
+						return false;
+				}
+
+				if (output.size() >= 1 << 16) {
+					out.write(output.data(), static_cast<std::streamsize>(output.size()));
+					output.clear();
+				}
+			}
+			out.write(output.data(), static_cast<std::streamsize>(output.size()));
+			return reader.complete();
+		}
+
+	private:
+		// Decoded argument.
+		using Value = std::variant<std::int64_t, std::uint64_t, float, double, char, bool, const void *, std::string>;
+
+		// Buffered reader of the entries of a binary log file.
+		class Reader {
+			std::istream &in;
+			std::vector<char> buffer;
+			size_t position, length;
+
+			bool refill() {
+				in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+				length = static_cast<size_t>(in.gcount());
+				position = 0;
+				return length != 0;
+			}
+
+		public:
+			explicit Reader(std::istream &in) : in(in), buffer(1 << 16), position(0), length(0) {}
+
+			bool byte(unsigned char &value) {
+				if (position == length && !refill()) return false;
+				value = static_cast<unsigned char>(buffer[position++]);
+				return true;
+			}
+
+			bool varint(std::uint64_t &value) {
+				value = 0;
+				for (int shift = 0; shift < 64; shift += 7) {
+					unsigned char next;
+					if (!byte(next)) return false;
+					value |= static_cast<std::uint64_t>(next & 0x7F) << shift;
+					if (!(next & 0x80)) return true;
+				}
+				return false;
+			}
+
+			bool signedVarint(std::int64_t &value) {
+				std::uint64_t encoded;
+				if (!varint(encoded)) return false;
+				value = static_cast<std::int64_t>(encoded >> 1 ^ (0 - (encoded & 1)));
+				return true;
+			}
+
+			bool fixed(std::uint64_t &value, size_t size) {
+				value = 0;
+				for (size_t i = 0; i < size; i++) {
+					unsigned char next;
+					if (!byte(next)) return false;
+					value |= static_cast<std::uint64_t>(next) << i * 8;
+				}
+				return true;
+			}
+
+			bool bytes(std::string &out, std::uint64_t count) {
+				out.clear();
+				while (count) {
+					if (position == length && !refill()) return false;
+					const size_t n = static_cast<size_t>(std::min<std::uint64_t>(count, length - position));
+					out.append(buffer.data() + position, n);
+					position += n;
+					count -= n;
+				}
+				return true;
+			}
+
+			bool string(std::string &out) {
+				std::uint64_t count;
+				return varint(count) && bytes(out, count);
+			}
+
+			// Whether the input ended at an entry boundary, not because of a read error.
+			[[nodiscard]] bool complete() const { return !in.bad(); }
+		};
+
+		static bool readArgument(Reader &reader, Value &value) {
+			unsigned char type;
+			std::uint64_t bits;
+			if (!reader.byte(type)) return false;
+			switch (static_cast<Argument>(type)) {
+				case Argument::Signed: {
+					std::int64_t number;
+					if (!reader.signedVarint(number)) return false;
+					value = number;
+					return true;
+				}
+				case Argument::Unsigned:
+					if (!reader.varint(bits)) return false;
+					value = bits;
+					return true;
+				case Argument::Float:
+					if (!reader.fixed(bits, 4)) return false;
+					value = std::bit_cast<float>(static_cast<std::uint32_t>(bits));
+					return true;
+				case Argument::Double:
+					if (!reader.fixed(bits, 8)) return false;
+					value = std::bit_cast<double>(bits);
+					return true;
+				case Argument::Character:
+				case Argument::Boolean: {
+					unsigned char byte;
+					if (!reader.byte(byte)) return false;
+					if (static_cast<Argument>(type) == Argument::Boolean) value = byte != 0;
+					else value = static_cast<char>(byte);
+					return true;
+				}
+				case Argument::Pointer:
+					if (!reader.varint(bits)) return false;
+					value = reinterpret_cast<const void *>(static_cast<std::uintptr_t>(bits));
+					return true;
+				case Argument::String: {
+					std::string text;
+					if (!reader.string(text)) return false;
+					value = std::move(text);
+					return true;
+				}
+				default:
+					return false;
+			}
+		}
+
+		// Substitute decoded arguments into a format string, with the result of StringConverter::formatMessage() on POSIX.
+		static std::string formatArguments(const std::string &format, const std::vector<Value> &values) {
+			if (values.empty()) return format;
+			std::string result;
+			try {
+				parseFormat(format, values.size(), [&result](std::string_view text) { result += text; }, [&](size_t index, std::string_view spec) {
+					const std::string field = std::string("{:").append(spec) + '}';
+					std::visit([&](const auto &value) { std::vformat_to(std::back_inserter(result), field, std::make_format_args(value)); }, values[index]);
+				});
+				return result;
+			} catch (const std::exception &e) {
+				return format + "\302\2478\302\247o (" + e.what() + ')';
+			}
+		}
+
+		// Append a decoded record in the plain-text form of the log file.
+		static void appendRecord(std::string &out, std::int64_t timestamp, std::int64_t utcOffset, TimePrecision precision, const LogStyle &style,
+				const std::string &logger, const std::string &text) {
+			const OutputString message = StringConverter::toOutput(text);
+			MessageProcessor::appendFileLines(out, TimeUtils::formatTime(timestamp, utcOffset, precision), MessageProcessor::renderFileHeader(logger, style), message);
+		}
+	};
+
+	// A log record as passed to sinks, only valid during the call it is passed to.
+	class LogRecord {
+		friend class KlyLogger;
+
+		const LogStyle *style;
+		LoggerEntry *logger;
+		std::int64_t time;
+		// Message that is formatted when a sink first asks for the text, so that sinks which do not need it
+		// (e.g. the binary log file) save the work.
+		LogMessage *const source;
+		mutable OutputString formatted;
+		mutable OutputView text;
+		mutable bool isFormatted;
+		// Fields attached with kv(), encoded by FieldCodec.
+		std::string_view encodedFields;
+
+		LogRecord(const LogStyle *style, LoggerEntry *logger, std::int64_t time, OutputView text, std::string_view fields = {}) noexcept :
+			style(style), logger(logger), time(time), source(nullptr), text(text), isFormatted(true), encodedFields(fields) {}
+
+		LogRecord(const LogStyle *style, LoggerEntry *logger, std::int64_t time, LogMessage &source) :
+			style(style), logger(logger), time(time), source(&source), isFormatted(false), encodedFields(source.fields()) {}
+
+	public:
+		// Level of the record.
+		[[nodiscard]] LogLevel level() const noexcept { return style->severity; }
+
+		// Time of the log call in nanoseconds since the Unix epoch.
+		[[nodiscard]] std::int64_t timestamp() const noexcept { return time; }
+
+		// Name of the logger that made the call.
+		[[nodiscard]] const std::wstring &loggerName() const noexcept { return logger->name; }
+
+		// Formatted message in the output encoding (UTF-8, or UTF-16 on Windows), including line breaks and Minecraft color codes.
+		[[nodiscard]] OutputView message() const {
+			if (!isFormatted) {
+				size_t length;
+				if (const OutputChar *stored = source->view(length)) text = OutputView(stored, length);
+				else {
+					formatted = source->format();
+					text = formatted;
+				}
+				isFormatted = true;
+			}
+			return text;
+		}
+
+		// Fields attached to the log call with kv(), in the order they were given.
+		[[nodiscard]] std::vector<LogField> fields() const { return FieldCodec::toLogFields(encodedFields); }
+
+		// Formatted message without color codes.
+		[[nodiscard]] OutputString plainMessage() const {
+			const OutputView text = message();
+			OutputString plain;
+			size_t pos = 0;
+			while (pos < text.length()) {
+				pos = ConsoleHelper::appendPlainLine(text, pos, plain);
+				if (pos < text.length()) plain.push_back(text[pos++]);
+			}
+			return plain;
+		}
+
+		// The record in the plain-text form of the log file with logfmt fields, one UTF-8 string per line without the line break.
+		[[nodiscard]] std::vector<std::string> plainLines() const {
+			OutputString name;
+			ConsoleHelper::appendPlainLine(logger->outputName, 0, name);
+			std::string header = '[' + TimeUtils::formatTime(time) + style->level + "] ";
+			if (!name.empty()) header += '[' + StringConverter::toUtf8(name) + "] ";
+
+			const OutputView text = message();
+			std::vector<std::string> lines;
+			OutputString line;
+			MessageProcessor::forEachLine(text, [&](size_t start) {
+				line.clear();
+				const size_t end = ConsoleHelper::appendPlainLine(text, start, line);
+				lines.push_back(header + StringConverter::toUtf8(line));
+				return end;
+			});
+			if (!encodedFields.empty()) {
+				// Fields follow the last line, a message without lines gets the header line alone.
+				if (lines.empty()) lines.push_back(header.substr(0, header.length() - 1));
+				FieldCodec::appendLogfmt(lines.back(), encodedFields);
+			}
+			return lines;
+		}
+	};
+
+	// Destination of log records. Sinks are written by the logging thread, or by their own writer thread (see SinkOptions).
+	class Sink {
+		friend class KlyLogger;
+
+		std::atomic<LogLevel> threshold;
+		std::atomic_size_t dropped;
+		// Statistics kept by the thread that writes the sink, see SinkStats.
+		std::atomic_uint64_t writtenRecords, writtenBytes;
+		LatencyCounter latency;
+
+	public:
+		Sink() noexcept : threshold(LogLevel::Trace), dropped(0), writtenRecords(0), writtenBytes(0) {}
+		Sink(const Sink &) = delete;
+		Sink &operator=(const Sink &) = delete;
+		virtual ~Sink() = default;
+
+		// Output a record.
+		virtual void write(const LogRecord &record) = 0;
+
+		// Write buffered output, called when the flush policy asks for it and whenever the sink's records are drained.
+		virtual void flush() {}
+
+		// Store flushed output durably (e.g. fsync a file), called when KlyLogger::flush() is asked to sync.
+		virtual void sync() {}
+
+		// Number of bytes the sink currently buffers, compared against FlushPolicy::maxBufferedBytes.
+		[[nodiscard]] virtual size_t bufferedBytes() const { return 0; }
+
+		// Set the lowest level this sink outputs (default: LogLevel::Trace), safe to call while other threads log.
+		void setLevel(LogLevel level) noexcept { threshold.store(level, std::memory_order_relaxed); }
+
+		// Retrieve the lowest level this sink outputs.
+		[[nodiscard]] LogLevel getLevel() const noexcept { return threshold.load(std::memory_order_relaxed); }
+
+		// Check whether records of the given level are output by this sink.
+		[[nodiscard]] bool isEnabled(LogLevel level) const noexcept { return level >= threshold.load(std::memory_order_relaxed); }
+
+		// Number of records this sink missed because the queue of its writer thread was full.
+		[[nodiscard]] size_t droppedRecordCount() const noexcept { return dropped.load(std::memory_order_relaxed); }
+	};
+
+	// Sink that passes every record to a function.
+	class CallbackSink : public Sink {
+		const std::function<void(const LogRecord &)> callback;
+
+	public:
+		explicit CallbackSink(std::function<void(const LogRecord &)> callback) noexcept : callback(std::move(callback)) {}
+
+		void write(const LogRecord &record) override { callback(record); }
+	};
+
+	// Sink that keeps the most recent lines in memory, in the plain-text form of the log file.
+	class MemorySink : public Sink {
+		std::vector<std::string> ring;
+		size_t next = 0, count = 0;
+		mutable std::atomic_flag busy;
+
+		void lock() const noexcept {
+			while (busy.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+		}
+
+		void unlock() const noexcept { busy.clear(std::memory_order_release); }
+
+	public:
+		// Keep at most `capacity` lines.
+		explicit MemorySink(size_t capacity) : ring(std::max<size_t>(capacity, 1)) {}
+
+		void write(const LogRecord &record) override {
+			std::vector<std::string> lines = record.plainLines();
+			lock();
+			for (std::string &line : lines) {
+				ring[next].swap(line);
+				next = (next + 1) % ring.size();
+				count = std::min(count + 1, ring.size());
+			}
+			unlock();
+		}
+
+		// Copy of the kept lines, oldest first.
+		[[nodiscard]] std::vector<std::string> lines() const {
+			lock();
+			std::vector<std::string> result;
+			result.reserve(count);
+			for (size_t i = 0; i < count; i++) result.push_back(ring[(next + ring.size() - count + i) % ring.size()]);
+			unlock();
+			return result;
+		}
+
+		// Remove all kept lines.
+		void clear() noexcept {
+			lock();
+			next = count = 0;
+			unlock();
+		}
+	};
+
+	// How a sink is attached to the record stream.
+	struct SinkOptions {
+		// Write on a dedicated thread fed by its own queue, so that a slow sink does not hold up the others.
+		bool ownThread = false;
+		// What the logging thread does when the queue of a sink with its own thread is full.
+		OverflowPolicy overflowPolicy = OverflowPolicy::Block;
+	};
+
+	// Distribution of the time from log calls until their records were written, in buckets of powers of two.
+	struct LatencyHistogram {
+		static constexpr size_t BUCKETS = LATENCY_BUCKETS;
+
+		// buckets[0] counts records written in no measurable time, buckets[i] those that took from 2^(i-1) up to 2^i nanoseconds.
+		std::uint64_t buckets[BUCKETS]{};
+
+		// Number of records in the histogram.
+		[[nodiscard]] std::uint64_t count() const noexcept {
+			std::uint64_t total = 0;
+			for (const std::uint64_t bucket : buckets) total += bucket;
+			return total;
+		}
+
+		// Time within which the given fraction of the records were written (e.g. 0.99), rounded up to a power of two.
+		[[nodiscard]] std::chrono::nanoseconds percentile(double fraction) const noexcept {
+			const std::uint64_t total = count();
+			if (!total) return 0ns;
+			const auto rank = static_cast<std::uint64_t>(std::clamp(fraction, 0.0, 1.0) * static_cast<double>(total - 1));
+			std::uint64_t seen = 0;
+			size_t i = 0;
+			while (i < BUCKETS - 1 && (seen += buckets[i]) <= rank) i++;
+			return std::chrono::nanoseconds(i ? std::int64_t(1) << std::min<size_t>(i, 62) : 0);
+		}
+	};
+
+	// Statistics of a sink, see Stats.
+	struct SinkStats {
+		std::shared_ptr<Sink> sink;
+		// Records written to the sink and bytes it wrote out when flushed (the bytes it buffered, see Sink::bufferedBytes()).
+		std::uint64_t records, bytes;
+		// Records the sink missed because the queue of its writer thread was full, and records waiting in that queue.
+		size_t dropped, queueDepth;
+		// Time from the log call until the sink wrote the record. Sinks written by the logging thread share Stats::latency.
+		LatencyHistogram latency;
+	};
+
+	// Snapshot of what the logger has done since the program started, see stats(). All counts only grow.
+	struct Stats {
+		// Records accepted into the log queue, records the logging thread passed to the sinks,
+		// and records discarded because the queue was full or the logger was shut down.
+		std::uint64_t enqueued, written, dropped;
+		// Records waiting in the log queue now, the most that ever waited, and how many fit.
+		size_t queueDepth, queueHighWater, queueCapacity;
+		// Time from the log call until the logging thread had passed the record to its sinks.
+		LatencyHistogram latency;
+		// Sinks in the record stream, see addSink().
+		std::vector<SinkStats> sinks;
+		// Log file rotations and the time they took, including renaming and opening files.
+		std::uint64_t rotations;
+		std::chrono::nanoseconds rotationTime;
+		// Time spent in the functions registered with setBeforeLog() and setAfterLog().
+		std::chrono::nanoseconds callbackTime;
+		// Times the logging thread raised its priority because of a backlog (see SchedulingPolicy).
+		std::uint64_t priorityBoosts;
+	};
+
+private:
+	// Encoding of the fields attached to a log call with kv(): for every field its key as a string of BinaryLog, followed by
+	// its value with a BinaryLog::Argument tag (Signed, Unsigned, Double, Boolean or String). Fields are encoded on the calling
+	// thread and rendered by the thread writing a sink, as logfmt, as JSON or as LogField values for callbacks.
+	class FieldCodec {
+		using Argument = BinaryLog::Argument;
+
+	public:
+		// Decoded value, strings refer to the encoded fields.
+		using Value = std::variant<std::int64_t, std::uint64_t, double, bool, std::string_view>;
+
+		// Append a field.
+		template<typename Key, typename T>
+		static void put(std::string &out, const KeyValue<Key, T> &field) {
+			putText(out, field.key);
+			const T &value = field.value;
+			if constexpr (std::is_same_v<T, bool>) {
+				BinaryLog::putTag(out, Argument::Boolean);
+				out.push_back(value);
+			} else if constexpr (std::is_same_v<T, char> || std::is_same_v<T, wchar_t>) {
+				BinaryLog::putTag(out, Argument::String);
+				putText(out, std::basic_string_view<T>(&value, 1));
+			} else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+				BinaryLog::putTag(out, Argument::Signed);
+				BinaryLog::putSigned(out, value);
+			} else if constexpr (std::is_integral_v<T>) {
+				BinaryLog::putTag(out, Argument::Unsigned);
+				BinaryLog::putVarint(out, value);
+			} else if constexpr (std::is_floating_point_v<T>) {
+				BinaryLog::putTag(out, Argument::Double);
+				const auto bits = std::bit_cast<std::uint64_t>(static_cast<double>(value));
+				for (size_t i = 0; i < sizeof(bits); i++) out.push_back(static_cast<char>(bits >> i * 8));
+			} else {
+				BinaryLog::putTag(out, Argument::String);
+				if constexpr (StringConverter::isNarrowString<T>) putText(out, std::string_view(value));
+				else if constexpr (StringConverter::isWideString<T>) putText(out, std::wstring_view(value));
+				else if constexpr (has_string<T>::value) putText(out, std::string_view(value.string()));
+				else if constexpr (has_wstring<T>::value) putText(out, std::wstring_view(value.wstring()));
+				else {
+					const size_t start = out.size();
+					if constexpr (std::is_default_constructible_v<std::formatter<T, char>>) std::format_to(std::back_inserter(out), "{}", value);
+					else StringConverter::appendUtf8(out, std::format(L"{}", value));
+					prefixLength(out, start);
+				}
+			}
+		}
+
+		// Call `visit(key, value)` for every field, stopping early at malformed input.
+		template<typename Visitor>
+		static void forEach(std::string_view fields, Visitor &&visit) {
+			size_t pos = 0;
+			std::string_view key, text;
+			std::uint64_t number;
+			while (readText(fields, pos, key) && pos < fields.length()) {
+				switch (static_cast<Argument>(fields[pos++])) {
+					case Argument::Signed:
+						if (!readVarint(fields, pos, number)) return;
+						visit(key, Value(static_cast<std::int64_t>(number >> 1 ^ (0 - (number & 1)))));
+						break;
+					case Argument::Unsigned:
+						if (!readVarint(fields, pos, number)) return;
+						visit(key, Value(number));
+						break;
+					case Argument::Double:
+						if (fields.length() - pos < sizeof(number)) return;
+						number = 0;
+						for (size_t i = 0; i < sizeof(number); i++) number |= static_cast<std::uint64_t>(static_cast<unsigned char>(fields[pos++])) << i * 8;
+						visit(key, Value(std::bit_cast<double>(number)));
+						break;
+					case Argument::Boolean:
+						if (pos == fields.length()) return;
+						visit(key, Value(fields[pos++] != 0));
+						break;
+					case Argument::String:
+						if (!readText(fields, pos, text)) return;
+						visit(key, Value(text));
+						break;
+					default:
+						return;
+				}
+			}
+		}
+
+		// Append the fields as logfmt pairs, each after a space. Characters a key cannot hold become '_',
+		// strings are quoted if they are empty or hold spaces, '=', quotes, backslashes or control characters.
+		// Inside quotes, control characters other than \n, \r and \t are escaped as \u00XX like in JSON.
+		static void appendLogfmt(std::string &out, std::string_view fields) {
+			forEach(fields, [&out](std::string_view key, const Value &value) {
+				out.push_back(' ');
+				if (key.empty()) out.push_back('_');
+				for (const char c : key) out.push_back(static_cast<unsigned char>(c) <= ' ' || c == '\x7f' || c == '=' || c == '"' || c == '\\' ? '_' : c);
+				out.push_back('=');
+				const auto *text = std::get_if<std::string_view>(&value);
+				if (!text) appendNumber(out, value, false);
+				else if (!text->empty() && std::none_of(text->begin(), text->end(), [](char c) { return static_cast<unsigned char>(c) <= ' ' || c == '\x7f' || c == '=' || c == '"' || c == '\\'; }))
+					out += *text;
+				else {
+					out.push_back('"');
+					for (const char c : *text) {
+						if (c == '"' || c == '\\') out.push_back('\\');
+						if (c == '\n') out += "\\n";
+						else if (c == '\r') out += "\\r";
+						else if (c == '\t') out += "\\t";
+						else if (static_cast<unsigned char>(c) < ' ' || c == '\x7f') std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned char>(c));
+						else out.push_back(c);
+					}
+					out.push_back('"');
+				}
+			});
+		}
+
+		// Append the fields as members of a JSON object, each after a comma. Numbers that JSON cannot hold (NaN, infinities) become strings.
+		static void appendJson(std::string &out, std::string_view fields) {
+			forEach(fields, [&out](std::string_view key, const Value &value) {
+				out.push_back(',');
+				MessageProcessor::appendJsonString(out, key);
+				out.push_back(':');
+				if (const auto *text = std::get_if<std::string_view>(&value)) MessageProcessor::appendJsonString(out, *text);
+				else appendNumber(out, value, true);
+			});
+		}
+
+		// The fields as passed to callbacks.
+		static std::vector<LogField> toLogFields(std::string_view fields) {
+			std::vector<LogField> result;
+			forEach(fields, [&result](std::string_view key, const Value &value) {
+				LogField &field = result.emplace_back(LogField{StringConverter::toWString(std::string(key)), {}});
+				std::visit([&field](const auto &item) {
+					if constexpr (std::is_same_v<std::decay_t<decltype(item)>, std::string_view>) field.value = StringConverter::toWString(std::string(item));
+					else field.value = item;
+				}, value);
+			});
+			return result;
+		}
+
+	private:
+		// Append a value other than a string, with non-finite numbers quoted for JSON.
+		static void appendNumber(std::string &out, const Value &value, bool json) {
+			std::visit([&out, json](const auto &item) {
+				using Type = std::decay_t<decltype(item)>;
+				if constexpr (std::is_same_v<Type, bool>) out += item ? "true" : "false";
+				else if constexpr (std::is_same_v<Type, double>) {
+					if (json && !std::isfinite(item)) std::format_to(std::back_inserter(out), "\"{}\"", item);
+					else std::format_to(std::back_inserter(out), "{}", item);
+				} else if constexpr (!std::is_same_v<Type, std::string_view>) std::format_to(std::back_inserter(out), "{}", item);
+			}, value);
+		}
+
+		static void putText(std::string &out, std::string_view text) { BinaryLog::putString(out, text); }
+
+		static void putText(std::string &out, std::wstring_view text) {
+			const size_t start = out.size();
+			StringConverter::appendUtf8(out, text);
+			prefixLength(out, start);
+		}
+
+		// Insert the length of the text appended since `start` in front of it, as the varint of a BinaryLog string.
+		static void prefixLength(std::string &out, size_t start) {
+			char length[10];
+			size_t count = 0;
+			std::uint64_t value = out.size() - start;
+			for (; value >= 0x80; value >>= 7) length[count++] = static_cast<char>(value | 0x80);
+			length[count++] = static_cast<char>(value);
+			out.insert(start, length, count);
+		}
+
+		static bool readVarint(std::string_view in, size_t &pos, std::uint64_t &value) {
+			value = 0;
+			for (int shift = 0; shift < 64 && pos < in.length(); shift += 7) {
+				const auto next = static_cast<unsigned char>(in[pos++]);
+				value |= static_cast<std::uint64_t>(next & 0x7F) << shift;
+				if (!(next & 0x80)) return true;
+			}
+			return false;
+		}
+
+		static bool readText(std::string_view in, size_t &pos, std::string_view &text) {
+			std::uint64_t length;
+			if (pos >= in.length() || !readVarint(in, pos, length) || length > in.length() - pos) return false;
+			text = in.substr(pos, static_cast<size_t>(length));
+			pos += static_cast<size_t>(length);
+			return true;
+		}
+	};
+
+#ifndef KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER
+	// Always-on record of the most recent log calls of every thread, including calls below the level of the logger.
+	// It is written to logs/crash-<seconds since epoch>-<pid>.log by fatal(), on SIGSEGV, SIGABRT and SIGBUS, and on std::terminate.
+	// Every thread owns a ring of fixed-size slots that only it writes, holding the address of a format marked with literal() (other
+	// formats are copied in front of the arguments) and the arguments in the encoding of BinaryLog, cut off when they do not fit. Slots are guarded by sequence numbers,
+	// so the dump can read them from any thread. The dump only reads memory and calls open(), write() and close(), which
+	// keeps it safe inside a signal handler; it ignores format specs and shows floating-point numbers with up to six decimals.
+	class FlightRecorder {
+		static constexpr size_t SIZE = KLY_LOGGER_OPTION_FLIGHT_RECORDER_SIZE;
+		static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "Flight recorder size must be a power of two.");
+		static constexpr size_t PAYLOAD_SIZE = 192;
+
+		using Argument = BinaryLog::Argument;
+
+		// Where the message format of a record is stored.
+		enum class Format : unsigned char {
+			// Address of a narrow or wide string literal.
+			Narrow,
+			Wide,
+			// First item of the payload.
+			Inline
+		};
+
+		struct Record {
+			std::int64_t timestamp;
+			LoggerEntry *logger;
+			const void *format;
+			// Number of the thread, counting from 0 in the order of their first log call.
+			std::uint32_t thread;
+			unsigned char level;
+			Format formatKind;
+			bool truncated;
+			unsigned char length;
+			char payload[PAYLOAD_SIZE];
+		};
+
+		struct Slot {
+			// Odd while the owner thread writes the record.
+			std::atomic_uint32_t sequence;
+			Record record;
+		};
+
+		// Ring of one thread, taken over by a new thread once its owner has exited.
+		struct Ring {
+			Slot slots[SIZE];
+			// Number of records written so far.
+			std::atomic_size_t written;
+			std::atomic_bool owned;
+			Ring *next;
+			// Records still to be written by the running dump.
+			size_t cursor, end;
+		};
+
+		// Releases the ring of a thread when it exits.
+		struct Owner {
+			Ring *ring;
+			std::uint32_t thread;
+
+			Owner() noexcept : ring(nullptr), thread(0) {}
+
+			~Owner() {
+				if (ring) ring->owned.store(false, std::memory_order_release);
+			}
+		};
+
+		// Bounded writer filling the payload of a record, writes that do not fit set `full`.
+		struct Payload {
+			char *data;
+			size_t length;
+			bool full, truncated;
+
+			explicit Payload(char *data) noexcept : data(data), length(0), full(false), truncated(false) {}
+
+			void push_back(char c) noexcept {
+				if (length < PAYLOAD_SIZE) data[length++] = c;
+				else full = true;
+			}
+
+			Payload &operator+=(std::string_view text) noexcept {
+				if (text.length() > PAYLOAD_SIZE - length) full = true;
+				else {
+					std::memcpy(data + length, text.data(), text.length());
+					length += text.length();
+				}
+				return *this;
+			}
+		};
+
+		// Code units of narrow or wide text, which may be unaligned inside a payload.
+		struct Units {
+			const char *data;
+			size_t length, width;
+
+			std::uint32_t operator[](size_t i) const noexcept {
+				if (width == 1) return static_cast<unsigned char>(data[i]);
+				wchar_t unit;
+				std::memcpy(&unit, data + i * sizeof(wchar_t), sizeof(wchar_t));
+				return static_cast<std::uint32_t>(unit);
+			}
+		};
+
+		// Decoded payload item.
+		struct Item {
+			Argument type;
+			std::uint64_t bits;
+			Units text;
+		};
+
+		// Buffered output of the dump, writing message text as UTF-8 without Minecraft color codes.
+		class Writer {
+			int file;
+			char buffer[4096];
+			size_t length;
+			// Color code stripping state: a '§' lead byte waiting for its second byte, the code character still
+			// to be skipped and the continuation bytes of a skipped character. Pending high surrogate of UTF-16 text.
+			bool markerLead, skipCode;
+			size_t skipContinuation;
+			std::uint32_t highSurrogate;
+
+			void byte(unsigned char c) noexcept {
+				if (c == '\r' || c == '\n') {
+					endText();
+					if (c == '\n') put('\n');
+					return;
+				}
+				if (skipContinuation) {
+					if ((c & 0xC0) == 0x80) {
+						skipContinuation--;
+						return;
+					}
+					skipContinuation = 0;
+				}
+				if (skipCode) {
+					skipCode = false;
+					skipContinuation = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+					return;
+				}
+				if (markerLead) {
+					markerLead = false;
+					if (c == 0xA7) {
+						skipCode = true;
+						return;
+					}
+					put('\xC2');
+				}
+				if (c == 0xC2) markerLead = true;
+				else put(static_cast<char>(c));
+			}
+
+		public:
+			explicit Writer(int file) noexcept : file(file), length(0), markerLead(false), skipCode(false), skipContinuation(0), highSurrogate(0) {}
+
+			void put(char c) noexcept {
+				if (length == sizeof(buffer)) flush();
+				buffer[length++] = c;
+			}
+
+			void write(std::string_view text) noexcept {
+				for (const char c : text) put(c);
+			}
+
+			// Write a number with at least `digits` digits.
+			void number(std::uint64_t value, int digits = 1, unsigned base = 10) noexcept {
+				char reversed[64];
+				int count = 0;
+				do {
+					reversed[count++] = "0123456789abcdef"[value % base];
+					value /= base;
+				} while (value || count < digits);
+				while (count) put(reversed[--count]);
+			}
+
+			// Write a floating-point number with up to six decimals, in scientific notation if it is very large or small.
+			void real(double value) noexcept {
+				if (value != value) return write("nan");
+				if (value < 0) {
+					put('-');
+					value = -value;
+				}
+				if (value > 1.7976931348623157e308) return write("inf");
+
+				int exponent = 0;
+				if (value != 0 && (value >= 1e16 || value < 1e-4)) {
+					for (; value >= 10; exponent++) value /= 10;
+					for (; value < 1; exponent--) value *= 10;
+				}
+				auto integer = static_cast<std::uint64_t>(value);
+				auto fraction = static_cast<std::uint64_t>((value - static_cast<double>(integer)) * 1e6 + 0.5);
+				if (fraction >= 1000000) {
+					integer++;
+					fraction -= 1000000;
+				}
+				number(integer);
+				if (fraction) {
+					int digits = 6;
+					for (; fraction % 10 == 0; digits--) fraction /= 10;
+					put('.');
+					number(fraction, digits);
+				}
+				if (exponent) {
+					put('e');
+					put(exponent < 0 ? '-' : '+');
+					number(static_cast<std::uint64_t>(exponent < 0 ? -exponent : exponent), 2);
+				}
+			}
+
+			// Write a code unit of narrow (UTF-8) or wide text.
+			void unit(std::uint32_t c, size_t width) noexcept {
+				if (width == 1) return byte(static_cast<unsigned char>(c));
+				if (width == 2) {
+					if (c >= 0xD800 && c <= 0xDBFF) {
+						highSurrogate = c;
+						return;
+					}
+					if (c >= 0xDC00 && c <= 0xDFFF && highSurrogate) c = 0x10000 + ((highSurrogate - 0xD800) << 10) + (c - 0xDC00);
+					highSurrogate = 0;
+				}
+				if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) c = 0xFFFD;
+				if (c < 0x80) return byte(static_cast<unsigned char>(c));
+				if (c < 0x800) byte(static_cast<unsigned char>(0xC0 | c >> 6));
+				else {
+					if (c < 0x10000) byte(static_cast<unsigned char>(0xE0 | c >> 12));
+					else {
+						byte(static_cast<unsigned char>(0xF0 | c >> 18));
+						byte(static_cast<unsigned char>(0x80 | (c >> 12 & 0x3F)));
+					}
+					byte(static_cast<unsigned char>(0x80 | (c >> 6 & 0x3F)));
+				}
+				byte(static_cast<unsigned char>(0x80 | (c & 0x3F)));
+			}
+
+			void text(const Units &units) noexcept {
+				for (size_t i = 0; i < units.length; i++) unit(units[i], units.width);
+				endText();
+			}
+
+			// Reset the color code state at the end of a piece of text.
+			void endText() noexcept {
+				if (markerLead) put('\xC2');
+				markerLead = skipCode = false;
+				skipContinuation = 0;
+				highSurrogate = 0;
+			}
+
+			void flush() noexcept {
+				const char *data = buffer;
+				while (length) {
+#ifdef _WIN32
+					const int written = _write(file, data, static_cast<unsigned>(length));
+#else
+					const ssize_t written = ::write(file, data, length);
+					if (written < 0 && errno == EINTR) continue;
+#endif
+					if (written <= 0) break;
+					data += written;
+					length -= static_cast<size_t>(written);
+				}
+				length = 0;
+			}
+		};
+
+	public:
+		// Offset of local time from UTC in seconds, as used by the dump.
+		static inline std::atomic<std::int64_t> utcOffset;
+
+		// Store a log call in the ring of the calling thread.
+		template<typename MessageType, typename... Args>
+		static void record(const LogStyle &style, LoggerEntry *logger, std::int64_t timestamp, const MessageType &message, const Args &...args) noexcept {
+			Ring *ring = owner.ring ? owner.ring : acquireRing();
+			if (!ring) return;
+
+			const size_t index = ring->written.load(std::memory_order_relaxed);
+			Slot &slot = ring->slots[index & (SIZE - 1)];
+			const std::uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+			slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			Record &record = slot.record;
+			record.timestamp = timestamp;
+			record.logger = logger;
+			record.thread = owner.thread;
+			record.level = static_cast<unsigned char>(style.severity);
+			Payload payload(record.payload);
+			if constexpr (StringConverter::isLiteral<MessageType>) {
+				record.format = message.text;
+				record.formatKind = std::is_same_v<MessageType, StringConverter::Literal<char>> ? Format::Narrow : Format::Wide;
+			} else {
+				record.format = nullptr;
+				record.formatKind = Format::Inline;
+				putArgument(payload, message);
+			}
+			// Arguments after the first one that does not fit are left out.
+			[[maybe_unused]] const auto put = [&payload](const auto &arg) {
+				if (payload.truncated) return;
+				const size_t before = payload.length;
+				putArgument(payload, arg);
+				if (payload.full) {
+					payload.length = before;
+					payload.truncated = true;
+				}
+			};
+			(put(args), ...);
+			record.truncated = payload.truncated;
+			record.length = static_cast<unsigned char>(payload.length);
+
+			slot.sequence.store(sequence + 2, std::memory_order_release);
+			ring->written.store(index + 1, std::memory_order_release);
+		}
+
+		// Write the recorded calls of all threads to a crash file, oldest first, unless another dump is running.
+		static void dump(const char *reason) noexcept {
+			if (dumping.test_and_set(std::memory_order_acquire)) return;
+			const int file = openCrashFile();
+			if (file >= 0) {
+				Writer out(file);
+				out.write("KlyLogger flight recorder (");
+				out.write(reason);
+				out.write("), process ");
+				out.number(static_cast<std::uint64_t>(getProcessId()));
+				out.put('\n');
+
+				for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+					ring->end = ring->written.load(std::memory_order_acquire);
+					ring->cursor = ring->end > SIZE ? ring->end - SIZE : 0;
+				}
+
+				// Merge the rings by time, skipping records that are overwritten while the dump runs.
+				Record current, oldest;
+				while (true) {
+					Ring *selected = nullptr;
+					for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+						for (; ring->cursor < ring->end; ring->cursor++) {
+							if (!read(*ring, ring->cursor, current)) continue;
+							if (!selected || current.timestamp < oldest.timestamp) {
+								selected = ring;
+								std::memcpy(&oldest, &current, sizeof(Record));
+							}
+							break;
+						}
+					}
+					if (!selected) break;
+					writeRecord(out, oldest);
+					selected->cursor++;
+				}
+				out.flush();
+#ifdef _WIN32
+				_close(file);
+#else
+				close(file);
+#endif
+			}
+			dumping.clear(std::memory_order_release);
+		}
+
+		// Register the crash handlers, remembering the previous ones to pass crashes on to them.
+		static bool install() {
+			crashDirectory = (FileLogger::getExecutablePath().parent_path() / "logs").native();
+			const time_t now = time(nullptr);
+			utcOffset.store(TimeUtils::toEpochSeconds(TimeUtils::toLocalTime(now)) - now, std::memory_order_relaxed);
+			previousTerminate = std::set_terminate(handleTerminate);
+#ifdef _WIN32
+			for (size_t i = 0; i < std::size(SIGNALS); i++) previousHandlers[i] = std::signal(SIGNALS[i], handleSignal);
+#else
+			// Give the installing thread an alternate signal stack, so that its stack overflowing can still be dumped.
+			stack_t current;
+			if (!sigaltstack(nullptr, &current) && (current.ss_flags & SS_DISABLE)) {
+				static char alternateStack[1 << 16];
+				stack_t stack{};
+				stack.ss_sp = alternateStack;
+				stack.ss_size = sizeof(alternateStack);
+				sigaltstack(&stack, nullptr);
+			}
+
+			struct sigaction action{};
+			action.sa_handler = handleSignal;
+			action.sa_flags = SA_ONSTACK;
+			sigemptyset(&action.sa_mask);
+			for (size_t i = 0; i < std::size(SIGNALS); i++) sigaction(SIGNALS[i], &action, &previousActions[i]);
+#endif
+			return true;
+		}
+
+	private:
+#ifdef SIGBUS
+		static constexpr int SIGNALS[]{SIGSEGV, SIGABRT, SIGBUS};
+#else
+		static constexpr int SIGNALS[]{SIGSEGV, SIGABRT};
+#endif
+
+		// Registered rings, the ring of the current thread and the dump state.
+		static inline std::atomic<Ring *> rings;
+		static inline thread_local Owner owner;
+		static inline std::atomic_uint32_t threadCount;
+		static inline std::atomic_flag dumping, crashed;
+		// Native path of the logs directory, prepared up front since the dump may not allocate.
+		static inline std::filesystem::path::string_type crashDirectory;
+		// Handlers that were installed before the flight recorder.
+		static inline std::terminate_handler previousTerminate;
+#ifdef _WIN32
+		static inline void (*previousHandlers[std::size(SIGNALS)])(int);
+#else
+		static inline struct sigaction previousActions[std::size(SIGNALS)];
+#endif
+
+		// Take over the ring of an exited thread, or register a new one.
+		static Ring *acquireRing() noexcept {
+			owner.thread = threadCount.fetch_add(1, std::memory_order_relaxed);
+			for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+				bool expected = false;
+				if (!ring->owned.load(std::memory_order_relaxed) && ring->owned.compare_exchange_strong(expected, true, std::memory_order_acquire))
+					return owner.ring = ring;
+			}
+
+			Ring *ring = new (std::nothrow) Ring();
+			if (!ring) return nullptr;
+			ring->owned.store(true, std::memory_order_relaxed);
+			ring->next = rings.load(std::memory_order_relaxed);
+			while (!rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed)) {}
+			return owner.ring = ring;
+		}
+
+		// Store text, cut off to the space left in the payload.
+		template<typename Char>
+		static void putText(Payload &out, std::basic_string_view<Char> text) noexcept {
+			const size_t room = PAYLOAD_SIZE - out.length;
+			if (room < 3) {
+				out.full = true;
+				return;
+			}
+			const size_t count = std::min(text.length(), (room - 3) / sizeof(Char));
+			BinaryLog::putTag(out, sizeof(Char) == 1 ? Argument::String : Argument::WideString);
+			BinaryLog::putVarint(out, count);
+			out += std::string_view(reinterpret_cast<const char *>(text.data()), count * sizeof(Char));
+			if (count < text.length()) out.truncated = true;
+		}
+
+		// Store an argument as it was passed, types that would need formatting are stored as "?".
+		template<typename T>
+		static void putArgument(Payload &out, const T &arg) noexcept {
+			if constexpr (std::is_same_v<T, std::nullptr_t>) BinaryLog::putArgument(out, static_cast<const void *>(nullptr));
+			else if constexpr (std::is_convertible_v<const T &, std::string_view>) putText(out, std::string_view(arg));
+			else if constexpr (std::is_convertible_v<const T &, std::wstring_view>) putText(out, std::wstring_view(arg));
+			else if constexpr (std::is_same_v<T, wchar_t>) putText(out, std::wstring_view(&arg, 1));
+			else if constexpr (std::is_same_v<T, long double>) BinaryLog::putArgument(out, static_cast<double>(arg));
+			else if constexpr (std::is_arithmetic_v<T> || (std::is_pointer_v<T> && !std::is_function_v<std::remove_pointer_t<T>>)) BinaryLog::putArgument(out, arg);
+			else putText(out, std::string_view("?"));
+		}
+
+		// Copy a record unless it is being written or has been overwritten.
+		static bool read(const Ring &ring, size_t index, Record &record) noexcept {
+			const Slot &slot = ring.slots[index & (SIZE - 1)];
+			const std::uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence & 1 || ring.written.load(std::memory_order_acquire) - index > SIZE) return false;
+			std::memcpy(&record, &slot.record, sizeof(Record));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return slot.sequence.load(std::memory_order_relaxed) == sequence && ring.written.load(std::memory_order_relaxed) - index <= SIZE;
+		}
+
+		// Write a record as a line like in the log file, with the thread number after the level.
+		static void writeRecord(Writer &out, const Record &record) noexcept {
+			const std::int64_t second = record.timestamp / 1000000000 - (record.timestamp % 1000000000 < 0);
+			const auto secondOfDay = static_cast<std::uint64_t>(((second + utcOffset.load(std::memory_order_relaxed)) % 86400 + 86400) % 86400);
+			out.put('[');
+			out.number(secondOfDay / 3600, 2);
+			out.put(':');
+			out.number(secondOfDay / 60 % 60, 2);
+			out.put(':');
+			out.number(secondOfDay % 60, 2);
+			out.put('.');
+			out.number(static_cast<std::uint64_t>(record.timestamp - second * 1000000000) / 1000, 6);
+			out.put(' ');
+			out.write(LOG_STYLES[record.level]->level);
+			out.write("] [T");
+			out.number(record.thread);
+			out.write("] ");
+			const OutputString &name = record.logger->outputName;
+			if (!name.empty()) {
+				out.put('[');
+				out.text({reinterpret_cast<const char *>(name.data()), name.length(), sizeof(OutputChar)});
+				out.write("] ");
+			}
+
+			Item items[PAYLOAD_SIZE / 2]{};
+			size_t count = parsePayload(record, items);
+			Units format{};
+			if (record.formatKind == Format::Narrow) format = {static_cast<const char *>(record.format), std::strlen(static_cast<const char *>(record.format)), 1};
+			else if (record.formatKind == Format::Wide) {
+				const auto *wide = static_cast<const wchar_t *>(record.format);
+				format = {reinterpret_cast<const char *>(wide), std::wcslen(wide), sizeof(wchar_t)};
+			} else if (count) {
+				// A message that is not a string, e.g. logger.info(42), is output as a value and takes no arguments.
+				if (items[0].type == Argument::String || items[0].type == Argument::WideString) format = items[0].text;
+				else {
+					writeArgument(out, items[0]);
+					count = 1;
+				}
+				count--;
+			}
+			writeFormat(out, format, record.formatKind == Format::Inline ? items + 1 : items, count);
+			if (record.truncated) out.write(" [truncated]");
+			out.put('\n');
+		}
+
+		// Split the payload of a record into items, returns their number.
+		static size_t parsePayload(const Record &record, Item *items) noexcept {
+			size_t count = 0, pos = 0;
+			const auto varint = [&record, &pos](std::uint64_t &value) {
+				value = 0;
+				for (int shift = 0; pos < record.length && shift < 64; shift += 7) {
+					const auto next = static_cast<unsigned char>(record.payload[pos++]);
+					value |= static_cast<std::uint64_t>(next & 0x7F) << shift;
+					if (!(next & 0x80)) return true;
+				}
+				return false;
+			};
+			const auto fixed = [&record, &pos](std::uint64_t &value, size_t size) {
+				if (record.length - pos < size) return false;
+				value = 0;
+				for (size_t i = 0; i < size; i++) value |= static_cast<std::uint64_t>(static_cast<unsigned char>(record.payload[pos++])) << i * 8;
+				return true;
+			};
+
+			while (pos < record.length) {
+				Item &item = items[count];
+				item.type = static_cast<Argument>(record.payload[pos++]);
+				item.bits = 0;
+				bool valid;
+				switch (item.type) {
+					case Argument::Signed:
+					case Argument::Unsigned:
+					case Argument::Pointer:
+						valid = varint(item.bits);
+						break;
+					case Argument::Float:
+						valid = fixed(item.bits, 4);
+						break;
+					case Argument::Double:
+						valid = fixed(item.bits, 8);
+						break;
+					case Argument::Character:
+					case Argument::Boolean:
+						valid = fixed(item.bits, 1);
+						break;
+					case Argument::String:
+					case Argument::WideString: {
+						const size_t width = item.type == Argument::String ? 1 : sizeof(wchar_t);
+						valid = varint(item.bits) && item.bits <= (record.length - pos) / width;
+						if (valid) {
+							item.text = {record.payload + pos, static_cast<size_t>(item.bits), width};
+							pos += static_cast<size_t>(item.bits) * width;
+						}
+						break;
+					}
+					default:
+						valid = false;
+				}
+				if (!valid) break;
+				count++;
+			}
+			return count;
+		}
+
+		// Substitute the arguments into the format, by position only. Without arguments the format is written as-is, like formatMessage() does.
+		static void writeFormat(Writer &out, const Units &format, const Item *arguments, size_t count) noexcept {
+			size_t next = 0;
+			for (size_t i = 0; i < format.length; i++) {
+				const std::uint32_t c = format[i];
+				if ((c == '{' || c == '}') && count && i + 1 < format.length && format[i + 1] == c) i++;
+				else if (c == '{' && count) {
+					size_t end = i + 1, index = 0;
+					bool manual = false;
+					for (; end < format.length && format[end] >= '0' && format[end] <= '9'; end++, manual = true) index = index * 10 + (format[end] - '0');
+					while (end < format.length && format[end] != '}') end++;
+					if (!manual) index = next++;
+					out.endText();
+					if (index < count) writeArgument(out, arguments[index]);
+					else out.write("{?}");
+					i = end;
+					continue;
+				}
+				out.unit(c, format.width);
+			}
+			out.endText();
+		}
+
+		static void writeArgument(Writer &out, const Item &item) noexcept {
+			switch (item.type) {
+				case Argument::Signed:
+					if (item.bits & 1) out.put('-');
+					out.number(item.bits & 1 ? (item.bits >> 1) + 1 : item.bits >> 1);
+					break;
+				case Argument::Unsigned:
+					out.number(item.bits);
+					break;
+				case Argument::Float:
+					out.real(std::bit_cast<float>(static_cast<std::uint32_t>(item.bits)));
+					break;
+				case Argument::Double:
+					out.real(std::bit_cast<double>(item.bits));
+					break;
+				case Argument::Character:
+					out.text({reinterpret_cast<const char *>(&item.bits), 1, 1});
+					break;
+				case Argument::Boolean:
+					out.write(item.bits ? "true" : "false");
+					break;
+				case Argument::Pointer:
+					out.write("0x");
+					out.number(item.bits, 1, 16);
+					break;
+				default:
+					out.text(item.text);
+			}
+		}
+
+		// Open logs/crash-<seconds since epoch>-<pid>.log for appending, creating the directory if needed.
+		static int openCrashFile() noexcept {
+			using Char = std::filesystem::path::value_type;
+			Char path[4096];
+			size_t length = 0;
+			const auto append = [&path, &length](auto c) {
+				if (length + 1 < std::size(path)) path[length++] = static_cast<Char>(c);
+			};
+			const auto appendNumber = [&append](std::uint64_t value) {
+				char reversed[20];
+				int count = 0;
+				do {
+					reversed[count++] = static_cast<char>('0' + value % 10);
+					value /= 10;
+				} while (value);
+				while (count) append(reversed[--count]);
+			};
+
+			for (const Char c : crashDirectory) append(c);
+			path[length] = 0;
+#ifdef _WIN32
+			_wmkdir(path);
+#else
+			mkdir(path, 0755);
+#endif
+			append(std::filesystem::path::preferred_separator);
+			for (const char c : std::string_view("crash-")) append(c);
+			appendNumber(static_cast<std::uint64_t>(time(nullptr)));
+			append('-');
+			appendNumber(static_cast<std::uint64_t>(getProcessId()));
+			for (const char c : std::string_view(".log")) append(c);
+			path[length] = 0;
+#ifdef _WIN32
+			return _wopen(path, _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+			return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+		}
+
+		static long getProcessId() noexcept {
+#ifdef _WIN32
+			return _getpid();
+#else
+			return getpid();
+#endif
+		}
+
+		// Dump once per process, even if several crash paths run (e.g. std::terminate raising SIGABRT).
+		static void crashDump(const char *reason) noexcept {
+			if (!crashed.test_and_set()) dump(reason);
+		}
+
+		// Dump, then restore the previous handler and deliver the signal to it again once this handler returns.
+		static void handleSignal(int signal) {
+			const int savedErrno = errno;
+			crashDump(signal == SIGSEGV ? "SIGSEGV" : signal == SIGABRT ? "SIGABRT" : "SIGBUS");
+			for (size_t i = 0; i < std::size(SIGNALS); i++) {
+				if (SIGNALS[i] != signal) continue;
+#ifdef _WIN32
+				std::signal(signal, previousHandlers[i]);
+#else
+				sigaction(signal, &previousActions[i], nullptr);
+#endif
+			}
+			errno = savedErrno;
+			std::raise(signal);
+		}
+
+		[[noreturn]] static void handleTerminate() {
+			crashDump("std::terminate");
+			if (previousTerminate) previousTerminate();
+			std::abort();
+		}
+	};
+#endif
+
+	// Decisions of the sampled log functions, kept per thread so that hot loops on several threads share nothing.
+	class Sampler {
+		static constexpr size_t CAPACITY = 256;
+		static constexpr size_t MAX_PROBES = 8;
+
+		// Call counter of a call site of the *Every() functions.
+		struct Counter {
+			const char *file;
+			std::uint_least32_t line, column;
+			size_t calls;
+		};
+
+		// Counters in a small table that reuses an entry when the call sites probed for a new one are all taken.
+		static inline thread_local Counter counters[CAPACITY];
+		// State of the xorshift generator deciding the *Sampled() calls.
+		static inline thread_local std::uint64_t randomState;
+
+	public:
+		// Count a call and return whether it is the first one of its call site or an interval-th one after it.
+		static bool every(const std::source_location &site, size_t interval) noexcept {
+			const std::uint64_t hash = (reinterpret_cast<std::uintptr_t>(site.file_name()) ^ static_cast<std::uint64_t>(site.line()) << 12 ^ site.column())
+					* 0x9E3779B97F4A7C15ull;
+			size_t index = static_cast<size_t>(hash >> (64 - std::countr_zero(CAPACITY)));
+			Counter *free = &counters[index];
+			for (size_t probe = 0; probe < MAX_PROBES; probe++, index = (index + 1) & (CAPACITY - 1)) {
+				Counter &counter = counters[index];
+				if (counter.file == site.file_name() && counter.line == site.line() && counter.column == site.column())
+					return counter.calls++ % std::max<size_t>(interval, 1) == 0;
+				if (!counter.file) {
+					free = &counter;
+					break;
+				}
+			}
+			*free = {site.file_name(), site.line(), site.column(), 1};
+			return true;
+		}
+
+		// Return true with the given probability.
+		static bool chance(double probability) noexcept {
+			if (probability >= 1) return true;
+			if (!(probability > 0)) return false;
+			std::uint64_t state = randomState;
+			if (!state) state = (reinterpret_cast<std::uintptr_t>(&randomState) ^ static_cast<std::uint64_t>(TimeUtils::now())) | 1;
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			randomState = state;
+			return static_cast<double>(state >> 11) < probability * 9007199254740992.0;
+		}
+	};
+
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+	// Ring of log records in POSIX shared memory, shared by every process that logs to the same logs directory.
+	// The process holding the lock on the ring is its writer: one of its threads moves the records of the ring into the local queue,
+	// so only that process writes the console and the log file. Every other process appends its records to the ring from its
+	// logging thread, while a thread of it waits for the lock to take over once the writer exits.
+	class SharedRing {
+		static constexpr size_t CAPACITY = KLY_LOGGER_OPTION_SHARED_RING_SIZE;
+		static_assert(CAPACITY >= 64 * 1024 && (CAPACITY & (CAPACITY - 1)) == 0, "Shared ring size must be a power of two of at least 64 KiB.");
+		static_assert(std::atomic_uint64_t::is_always_lock_free && std::atomic_uint32_t::is_always_lock_free);
+		// Identifies the layout and the size of the ring, processes built with other ones log on their own.
+		static constexpr std::uint64_t MAGIC = 0x324752494c4b4c4b ^ CAPACITY;
+		// Records are 8-byte aligned and start with their state: the size of the record, WRITTEN once it is complete,
+		// and PADDING for the unused end of the ring a record did not fit into. Zero means reserved but not yet sized.
+		static constexpr std::uint32_t WRITTEN = 1u << 31, PADDING = 1u << 30, SIZE_MASK = PADDING - 1;
+		// Time after which the writer checks whether the producer of a record that is still not written has exited.
+		static constexpr std::int64_t STALL_TIMEOUT = 1000000000;
+		// Processes that can append to the ring at the same time.
+		static constexpr size_t PRODUCERS = 256;
+
+		struct RecordHeader {
+			std::uint32_t state;
+			std::uint32_t level;
+			std::int64_t timestamp;
+			// Followed by the logger name (UTF-8), the message and the fields encoded by FieldCodec.
+			std::uint32_t nameLength, messageLength, fieldsLength, reserved;
+		};
+
+		// Process appending to the ring, and the bytes it is reserving or writing: their position plus one and their size, zero when none.
+		struct Producer {
+			std::atomic_uint32_t pid;
+			std::atomic_uint32_t size;
+			std::atomic_uint64_t position;
+		};
+
+		// Layout of the shared memory, all zero is an empty ring.
+		struct Shared {
+			std::atomic_uint64_t magic;
+			// Set when a record cannot be skipped safely, the processes then write their records themselves.
+			std::atomic_bool broken;
+			// Bytes reserved by producers and bytes the writer has consumed, counted since the ring was created.
+			alignas(64) std::atomic_uint64_t reserved;
+			alignas(64) std::atomic_uint64_t consumed;
+			// Signalled when a record is written and when the writer frees space.
+			alignas(64) BasicNotifier<true> written, freed;
+			alignas(64) Producer producers[PRODUCERS];
+			alignas(64) unsigned char data[CAPACITY];
+		};
+
+		static std::atomic_ref<std::uint32_t> stateOf(unsigned char *record) noexcept { return std::atomic_ref(*reinterpret_cast<std::uint32_t *>(record)); }
+
+		// Zero consumed bytes, so that a record reserved there later reads as not yet written.
+		static void clear(std::uint64_t position, std::uint64_t size) noexcept {
+			const size_t offset = position & (CAPACITY - 1), first = std::min<size_t>(size, CAPACITY - offset);
+			std::memset(shared->data + offset, 0, first);
+			std::memset(shared->data, 0, size - first);
+		}
+
+		// Whether the next record can be consumed.
+		static bool readable() noexcept {
+			const std::uint64_t position = shared->consumed.load(std::memory_order_relaxed);
+			return position != shared->reserved.load(std::memory_order_acquire) && (stateOf(shared->data + (position & (CAPACITY - 1))).load(std::memory_order_acquire) & WRITTEN)
+					&& !shared->broken.load(std::memory_order_relaxed);
+		}
+
+		// Whether the state of the record at a position fits the bytes reserved so far. Records do not wrap around the end of the ring,
+		// padding reaches up to it and is only needed by records larger than itself.
+		static bool validState(std::uint32_t state, std::uint64_t position, std::uint64_t end) noexcept {
+			const std::uint64_t size = state & SIZE_MASK, offset = position & (CAPACITY - 1);
+			if (!size || (size & 7) || size > CAPACITY / 4 || size > end - position) return false;
+			return state & PADDING ? (state & WRITTEN) && offset + size == CAPACITY : offset + size <= CAPACITY;
+		}
+
+		// Whether a process has exited. A process that is merely stopped, e.g. by a debugger, may still write to the ring later.
+		static bool exited(std::uint32_t pid) noexcept { return !pid || (kill(static_cast<pid_t>(pid), 0) && errno == ESRCH); }
 
-			size_t pos;
-			while ((pos = msg.find(L'\247')) != std::wstring::npos) {
-				const std::wstring part = msg.substr(0, pos);
-				write(part);
-				if (stripMsg) stripped += part;
-				if (isAtty && pos + 1 < msg.length()) applyMinecraftColorCode(msg[pos + 1], initialColor, ansiColor);
-				msg = msg.substr(pos + 2);
+		// Claim an entry of the producer table for this process. Entries of exited processes are reused once the writer
+		// has passed the bytes they announced, until then they tell the writer that the record there can be given up.
+		static Producer *registerProducer() noexcept {
+			const auto self = static_cast<std::uint32_t>(getpid());
+			for (Producer &entry : shared->producers) {
+				std::uint32_t pid = entry.pid.load();
+				if (pid) {
+					const std::uint64_t start = entry.position.load();
+					if (!exited(pid) || (start && start - 1 + entry.size.load() > shared->consumed.load())) continue;
+				}
+				if (!entry.pid.compare_exchange_strong(pid, self)) continue;
+				entry.position.store(0);
+				return &entry;
 			}
+			return nullptr;
+		}
 
-			if (!msg.empty()) {
-				write(msg);
-				if (stripMsg) stripped += msg;
+		// Bytes to give up at a record that is still not written, or zero while its producer may still write it. Its size is taken from
+		// the announcement of its producer if it is not stored yet. Marks the ring as broken if the record cannot be skipped safely.
+		static std::uint64_t abandonedSize(std::uint64_t position, std::uint64_t end, std::uint64_t size) noexcept {
+			std::uint64_t until = size ? position + size : 0;
+			bool announced = false;
+			for (Producer &entry : shared->producers) {
+				const std::uint64_t start = entry.position.load();
+				if (!start) continue;
+				const std::uint64_t length = entry.size.load();
+				if (entry.position.load() != start || position < start - 1 || position - (start - 1) >= length) continue;
+				if (!exited(entry.pid.load())) return 0;
+				announced = true;
+				if (!until) until = start - 1 + length;
 			}
+			// Producers withdraw their announcement only after the record is written.
+			if (!announced && (stateOf(shared->data + (position & (CAPACITY - 1))).load(std::memory_order_acquire) & WRITTEN)) return 0;
+			if (!announced || until <= position || until > end || ((until - position) & 7)) {
+				shared->broken.store(true);
+				return 0;
+			}
+			return until - position;
+		}
 
-			return stripped;
+		// Queue a record of another process as if it had been logged here.
+		static void enqueueRecord(const unsigned char *record, std::uint64_t size) {
+			RecordHeader header;
+			std::memcpy(&header, record, sizeof(header));
+			if (header.level >= std::size(LOG_STYLES) || sizeof(header) + std::uint64_t{header.nameLength} + header.messageLength + header.fieldsLength > size) return;
+			const std::string_view name(reinterpret_cast<const char *>(record + sizeof(header)), header.nameLength);
+			const OutputView message(name.data() + name.length(), header.messageLength);
+			const std::string_view fields(message.data() + message.length(), header.fieldsLength);
+
+			auto logger = loggers.find(std::string(name));
+			if (logger == loggers.end()) logger = loggers.emplace(name, internLoggerName(StringConverter::toWide(name))).first;
+			LogMessage text = !fields.empty() ? LogMessage(FieldMessage<PooledText>{PooledText(message), PooledFields(fields)})
+					: message.length() <= InlineText::CAPACITY ? LogMessage(InlineText(message)) : LogMessage(PooledText(message));
+			enqueue(LogTask{LOG_STYLES[header.level], logger->second, header.timestamp, std::move(text)});
 		}
 
-		// Set console text color and style based on a Minecraft-style color code.
-		static void applyMinecraftColorCode(wchar_t code, unsigned short initialColor, const std::string &ansiColor) {
-			// For color codes that only change the text color, use the special mapping.
-			if (L'0' <= code && code <= L'9') setColor(code - L'0', mcToAnsiEscape[code - L'0']);
-			else if (L'a' <= code && code <= L'f') setColor(code - L'W', mcToAnsiEscape[code - L'W']);
-			// For formatting codes, use a temporary specific mapping.
-			else {
-				auto it = updateMappingsAndFind(code, initialColor, ansiColor);
-				if (it != mappings.end()) setColor(it->second.first, it->second.second);
+		// Body of the thread that waits until this process is the writer, then moves the records of the ring into the queue.
+		static void run() {
+			setLowestThreadPriority();
+			// The kernel releases the lock when the writer process exits, one of the waiting processes then takes over.
+			while (flock(descriptor, LOCK_EX)) {
+				if (errno != EINTR) return;
 			}
-		}
+			if (stopping.load()) {
+				flock(descriptor, LOCK_UN);
+				return;
+			}
+			writer.store(true, std::memory_order_release);
 
-#ifdef _WIN32
-		// Get Windows stderr handle with optional caching.
-		static HANDLE getHandle() {
-#ifndef KLY_LOGGER_OPTION_NO_CACHE_FOR_OUTPUT_HANDLE
-			// In cache mode, no need to retrieve stderr handle each time.
-			static
-#endif
-			// In no-cache mode, retrieve the stderr handle on each output.
-			const HANDLE handle = GetStdHandle(STD_ERROR_HANDLE);
-			return handle;
+			std::shared_ptr<const SchedulingPolicy> scheduling;
+			size_t schedulingApplied = 0;
+			while (!stopping.load(std::memory_order_relaxed)) {
+				updateScheduling(scheduling, schedulingApplied);
+				// Wake up in time to skip a record that is stuck.
+				const bool stalled = drain();
+				shared->written.waitUntil([] { return readable() || stopping.load(std::memory_order_relaxed); }, stalled ? std::chrono::nanoseconds(STALL_TIMEOUT / 4) : -1ns);
+			}
 		}
-#endif
-	};
 
-	// File logging helper.
-	class FileLogger {
+		static inline Shared *shared;
+		// Entry of this process in the producer table.
+		static inline Producer *producer;
+		static inline int descriptor = -1;
+		// Name of the shared memory object, to open it again in a forked child.
+		static inline char name[32];
+		// Whether this process writes the records of the ring, and whether shutdown() stopped taking them.
+		static inline std::atomic_bool writer, stopping;
+		// Held while the records are moved into the queue.
+		static inline std::atomic_flag draining;
+		// Record that is not written yet and when it was first seen, logger names seen in the ring (while draining).
+		static inline std::uint64_t stalledPosition = UINT64_MAX;
+		static inline std::int64_t stalledSince;
+		static inline std::unordered_map<std::string, LoggerEntry *> loggers;
+		// Logger name of the record being appended (logging thread only).
+		static inline std::string nameBuffer;
+
 	public:
-		// Initialize file logging system if enabled.
-		static void initialize() {
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			logFile = getLogFileHandle();
-#endif
+		// Open or create the ring of the logs directory next to the executable and start waiting to become its writer.
+		// Without the ring, e.g. when shared memory is unavailable, the process writes its records itself.
+		static void attach() noexcept {
+			std::uint64_t hash = 14695981039346656037u;
+			for (const char c : (FileLogger::getExecutablePath().parent_path() / "logs").string()) hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211u;
+			*std::format_to_n(name, sizeof(name) - 1, "/klylogger-{:016x}", hash).out = 0;
+
+			const int file = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			if (file < 0) return;
+			struct stat fileStat;
+			// The first process sizes the ring, ftruncate() zero-fills it.
+			if (fstat(file, &fileStat) || (fileStat.st_size != sizeof(Shared) && (fileStat.st_size != 0 || ftruncate(file, sizeof(Shared))))) {
+				::close(file);
+				return;
+			}
+			void *memory = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			if (memory == MAP_FAILED) {
+				::close(file);
+				return;
+			}
+			Shared *ring = static_cast<Shared *>(memory);
+			std::uint64_t magic = 0;
+			if (!ring->magic.compare_exchange_strong(magic, MAGIC) && magic != MAGIC) {
+				munmap(memory, sizeof(Shared));
+				::close(file);
+				return;
+			}
+
+			shared = ring;
+			producer = registerProducer();
+			if (!producer) {
+				shared = nullptr;
+				munmap(memory, sizeof(Shared));
+				::close(file);
+				return;
+			}
+			descriptor = file;
+			try {
+				std::thread(run).detach();
+			} catch (...) {
+				// Nothing in this process would ever become the writer.
+				shared = nullptr;
+				munmap(memory, sizeof(Shared));
+				::close(file);
+				descriptor = -1;
+			}
 		}
 
-		// Pack date components into a compact unsigned integer representation.
-		static unsigned packDate(const std::tm &time) { return (time.tm_year << 16) + (time.tm_mon << 8) + time.tm_mday; }
+		// Whether this process writes the console and the log file itself.
+		[[nodiscard]] static bool isWriter() noexcept { return !shared || writer.load(std::memory_order_acquire) || shared->broken.load(std::memory_order_relaxed); }
 
-		// Update the log file handle for log rotation.
-		static void updateIfNeeded() {
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			if (packDate(TimeUtils::getLocalTime()) != logFileCreateDate) {
-				if (logFile.is_open()) logFile.close();
-				initialize();
+		// Append a record to the ring for the writer process, on the logging thread of any other process.
+		// Returns false if this process writes its records itself. Records that cannot be appended are counted as dropped.
+		static bool forward(const LogRecord &record) {
+			if (isWriter()) return false;
+			nameBuffer.clear();
+			StringConverter::appendUtf8(nameBuffer, record.logger->name);
+			const OutputView message = record.message();
+			const std::string_view fields = record.encodedFields;
+			const std::uint64_t size = (sizeof(RecordHeader) + nameBuffer.length() + message.length() + fields.length() + 7) & ~std::uint64_t{7};
+			if (size > CAPACITY / 4) {
+				droppedRecords.fetch_add(1, std::memory_order_relaxed);
+				return true;
 			}
-#endif
+
+			// Reserve the record, after padding up to the end of the ring if it does not fit in there. The bytes are announced
+			// before they are reserved, so the writer knows who owns them if the record is never written.
+			std::uint64_t position = shared->reserved.load(std::memory_order_relaxed), padding;
+			while (true) {
+				padding = CAPACITY - (position & (CAPACITY - 1));
+				if (padding >= size) padding = 0;
+				const std::uint64_t consumed = shared->consumed.load(std::memory_order_acquire);
+				if (consumed > position) position = shared->reserved.load(std::memory_order_relaxed);
+				else if (position + padding + size - consumed <= CAPACITY) {
+					producer->size.store(static_cast<std::uint32_t>(padding + size));
+					producer->position.store(position + 1);
+					if (shared->reserved.compare_exchange_weak(position, position + padding + size)) break;
+				} else if (overflowPolicy.load(std::memory_order_relaxed) != OverflowPolicy::Block || stopping.load(std::memory_order_relaxed)) {
+					producer->position.store(0, std::memory_order_release);
+					droppedRecords.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				} else {
+					// Wait for the writer to free space, in slices since the ring may have moved on meanwhile.
+					const std::uint64_t needed = position + padding + size - CAPACITY;
+					shared->freed.waitUntil([needed] { return shared->consumed.load(std::memory_order_acquire) >= needed || shared->broken.load(std::memory_order_relaxed); }, 10ms);
+					if (shared->broken.load(std::memory_order_relaxed)) {
+						producer->position.store(0, std::memory_order_release);
+						return false;
+					}
+					position = shared->reserved.load(std::memory_order_relaxed);
+				}
+			}
+
+			if (padding) stateOf(shared->data + (position & (CAPACITY - 1))).store(static_cast<std::uint32_t>(padding) | WRITTEN | PADDING, std::memory_order_release);
+			unsigned char *at = shared->data + ((position + padding) & (CAPACITY - 1));
+			// The size is stored first, so the writer can skip the record if this process dies before it is written.
+			stateOf(at).store(static_cast<std::uint32_t>(size), std::memory_order_relaxed);
+			const RecordHeader header{0, static_cast<std::uint32_t>(record.style->severity), record.time, static_cast<std::uint32_t>(nameBuffer.length()),
+					static_cast<std::uint32_t>(message.length()), static_cast<std::uint32_t>(fields.length()), 0};
+			std::memcpy(at + sizeof(header.state), reinterpret_cast<const unsigned char *>(&header) + sizeof(header.state), sizeof(header) - sizeof(header.state));
+			unsigned char *bytes = at + sizeof(header);
+			std::memcpy(bytes, nameBuffer.data(), nameBuffer.length());
+			std::memcpy(bytes += nameBuffer.length(), message.data(), message.length());
+			if (!fields.empty()) std::memcpy(bytes + message.length(), fields.data(), fields.length());
+			stateOf(at).store(static_cast<std::uint32_t>(size) | WRITTEN, std::memory_order_release);
+			producer->position.store(0, std::memory_order_release);
+			shared->written.notify();
+			return true;
 		}
 
-		// Get the absolute path of the current executable.
-		static std::filesystem::path getExecutablePath() {
-#ifdef _WIN32
-			// Get executable path on Windows.
-			wchar_t path[5120];
-			GetModuleFileNameW(nullptr, path, 5120);
-#else
-			// Get executable path on Linux.
-			char path[5120];
-			const ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
-			if (len == -1) return {};
-			path[len] = 0;
+		// Move the records written so far into the queue (writer only). Returns whether it stopped at a record that is still being written.
+		static bool drain() {
+			if (!shared || !writer.load(std::memory_order_acquire)) return false;
+			while (draining.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+			const std::uint64_t end = shared->reserved.load(std::memory_order_acquire);
+			std::uint64_t position = shared->consumed.load(std::memory_order_relaxed);
+			bool pending = false;
+			while (position != end && !shared->broken.load(std::memory_order_relaxed)) {
+				unsigned char *record = shared->data + (position & (CAPACITY - 1));
+				const std::uint32_t state = stateOf(record).load(std::memory_order_acquire);
+				std::uint64_t size = state & SIZE_MASK;
+				// Past a header that does not fit, the start of the next record is unknown.
+				if (state && !validState(state, position, end)) {
+					shared->broken.store(true);
+					break;
+				}
+				if (!(state & WRITTEN)) {
+					const std::int64_t now = TimeUtils::now();
+					if (position != stalledPosition) {
+						stalledPosition = position;
+						stalledSince = now;
+					}
+					if (now - stalledSince < STALL_TIMEOUT) {
+						pending = true;
+						break;
+					}
+					// Only the bytes of a producer that has exited are reclaimed, it cannot write into them anymore.
+					size = abandonedSize(position, end, size);
+					if (!size) {
+						pending = true;
+						break;
+					}
+					droppedRecords.fetch_add(1, std::memory_order_relaxed);
+				} else if (!(state & PADDING)) enqueueRecord(record, size);
+				clear(position, size);
+				position += size;
+				shared->consumed.store(position, std::memory_order_release);
+			}
+			draining.clear(std::memory_order_release);
+			shared->freed.notify();
+			return pending;
+		}
+
+		// Move the records left in the ring into the queue and stop taking more, called by shutdown() while the queue still accepts records.
+		static void stop() {
+			if (!shared) return;
+			drain();
+			stopping.store(true);
+			shared->written.notify();
+		}
+
+		// Let the next process take over the ring, once this one has written everything.
+		static void release() noexcept {
+			if (!shared) return;
+			producer->pid.store(0);
+			if (writer.load(std::memory_order_acquire)) flock(descriptor, LOCK_UN);
+		}
+
+		// Keep the records of the ring from being moved into the queue while the process forks.
+		static void prepareFork() noexcept {
+			while (draining.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+		}
+
+		// Let the records of the ring be moved into the queue again, in the parent after fork().
+		static void resumeAfterFork() noexcept { draining.clear(std::memory_order_release); }
+
+		// Join the ring as a process of its own, in the child after fork(). The inherited descriptor shares the lock of the parent,
+		// so the child opens the ring again and waits for the lock like any other process. Without it, the child writes its records itself.
+		static void restartAfterFork() noexcept {
+			draining.clear(std::memory_order_release);
+			if (!shared) return;
+			writer.store(false, std::memory_order_relaxed);
+			stopping.store(false, std::memory_order_relaxed);
+			stalledPosition = UINT64_MAX;
+			::close(descriptor);
+			// The entry of the parent stays with the parent.
+			producer = registerProducer();
+			descriptor = producer ? shm_open(name, O_RDWR | O_CLOEXEC, 0600) : -1;
+			if (descriptor >= 0) {
+				try {
+					std::thread(run).detach();
+					return;
+				} catch (...) {
+					::close(descriptor);
+					descriptor = -1;
+				}
+			}
+			munmap(shared, sizeof(Shared));
+			shared = nullptr;
+		}
+	};
 #endif
-			return path;
+
+	// Sink writing colored output to the console (stderr).
+	class ConsoleSink : public Sink {
+	public:
+		void write(const LogRecord &record) override {
+			if (const StreamFormat format = streamFormat.load(std::memory_order_relaxed); !isAtty && format != StreamFormat::None)
+				MessageProcessor::writeStreamMessage(*record.logger, record.message(), *record.style, record.time, record.encodedFields, format);
+			else if (isAtty || beforeLog) MessageProcessor::printMessage(*record.logger, record.message(), *record.style, record.time);
 		}
 
-		// Retrieve the current log file handle, creating directories and rotating logs if needed.
-		static std::ofstream getLogFileHandle() {
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			try {
-				// Initialize logs directory and latest log file path if empty.
-				if (logsDirectory.empty() || latestLog.empty()) {
-					logsDirectory = getExecutablePath().parent_path() / "logs";
-					latestLog = logsDirectory / "latest.log";
+		void flush() override { ConsoleHelper::flushConsole(); }
+
+		[[nodiscard]] size_t bufferedBytes() const override { return consoleBuffer.size() * sizeof(OutputChar) + streamBuffer.size(); }
+	};
+
+	// Sink writing plain text to logs/latest.log, or the binary format (see BinaryLog) to logs/latest.klog.
+	class FileSink : public Sink {
+#if defined(KLY_LOGGER_OPTION_BINARY_LOG_FILE) && !defined(KLY_LOGGER_OPTION_NO_LOG_FILE)
+		// Call site of a record: the address of its format string literal, its level and its logger.
+		struct SiteKey {
+			const void *format;
+			const LogStyle *style;
+			LoggerEntry *logger;
+
+			bool operator==(const SiteKey &) const = default;
+		};
+
+		struct SiteHash {
+			size_t operator()(const SiteKey &key) const noexcept {
+				return std::hash<const void *>()(key.format) ^ std::hash<const void *>()(key.logger) * 31 ^ static_cast<size_t>(key.style->severity);
+			}
+		};
+
+		// Ids of the call sites and loggers written to the current file, zero marks a call site that is written as text.
+		std::unordered_map<SiteKey, std::uint32_t, SiteHash> sites;
+		std::unordered_map<LoggerEntry *, std::uint32_t> loggers;
+		std::uint32_t siteCount;
+		// Log file the dictionary belongs to, and the state the following records are relative to.
+		size_t generation;
+		std::int64_t lastTimestamp, clockSecond, utcOffset;
+		TimePrecision precision;
+		bool clockWritten;
+		// Encoded arguments of the current record.
+		std::string arguments;
+
+		// Id of a logger in the current file, writing its name on first use.
+		std::uint32_t loggerId(LoggerEntry *logger) {
+			const auto [it, inserted] = loggers.try_emplace(logger, static_cast<std::uint32_t>(loggers.size()));
+			if (inserted) {
+				BinaryLog::putTag(fileBuffer, BinaryLog::Entry::Logger);
+				BinaryLog::putVarint(fileBuffer, it->second);
+				BinaryLog::putString(fileBuffer, StringConverter::toUtf8(logger->outputName));
+			}
+			return it->second;
+		}
+
+		// Append a record in the binary format, with the dictionary entries it needs first.
+		void writeBinaryRecord(const LogRecord &record) {
+			if (generation != logFileGeneration) {
+				generation = logFileGeneration;
+				sites.clear();
+				loggers.clear();
+				siteCount = 0;
+				lastTimestamp = 0;
+				clockWritten = false;
+				fileBuffer += BinaryLog::MAGIC;
+			}
+
+			// The offset from UTC is checked once per second, so the decoder shows the same local time across time zone changes.
+			const TimePrecision currentPrecision = timePrecision.load(std::memory_order_relaxed);
+			if (!clockWritten || cachedSecond != clockSecond || currentPrecision != precision) {
+				const std::int64_t offset = TimeUtils::toEpochSeconds(cachedLocalTime) - cachedSecond;
+				if (!clockWritten || offset != utcOffset || currentPrecision != precision) {
+					BinaryLog::putTag(fileBuffer, BinaryLog::Entry::Clock);
+					BinaryLog::putSigned(fileBuffer, offset);
+					fileBuffer.push_back(static_cast<char>(currentPrecision));
 				}
+				clockWritten = true;
+				clockSecond = cachedSecond;
+				utcOffset = offset;
+				precision = currentPrecision;
+			}
 
-				// Ensure log directory exists.
-				std::filesystem::create_directories(logsDirectory);
-				const std::tm time = TimeUtils::getLocalTime();
-				// Rename existing log file if present.
-				rotateLogFiles(time);
-				logFileCreateDate = packDate(time);
-				return std::ofstream(latestLog, std::ios::out | std::ios::trunc | std::ios::binary);
-			} catch (...) {
-				// Disable log file if any exception occurs.
-				return {};
+			const std::uint32_t logger = loggerId(record.logger);
+			size_t count = 0;
+			arguments.clear();
+			// Records with fields are written as text, with the fields as logfmt pairs after the message.
+			const void *format = record.source && record.encodedFields.empty() ? record.source->encode(arguments, count) : nullptr;
+			std::uint32_t site = 0;
+			if (format) {
+				const auto [it, inserted] = sites.try_emplace(SiteKey{format, record.style, record.logger}, 0);
+				if (inserted) {
+					// Formats the decoder cannot reproduce field by field are written as text.
+					const std::string text = record.source->formatString();
+					if (!count || BinaryLog::parseFormat(text, count, [](std::string_view) {}, [](size_t, std::string_view) {})) {
+						it->second = ++siteCount;
+						BinaryLog::putTag(fileBuffer, BinaryLog::Entry::Site);
+						BinaryLog::putVarint(fileBuffer, it->second);
+						fileBuffer.push_back(static_cast<char>(record.style->severity));
+						BinaryLog::putVarint(fileBuffer, logger);
+						BinaryLog::putString(fileBuffer, text);
+					}
+				}
+				site = it->second;
 			}
-#else
-			return {};
-#endif
+
+			if (site) {
+				BinaryLog::putTag(fileBuffer, BinaryLog::Entry::Record);
+				BinaryLog::putVarint(fileBuffer, site);
+				BinaryLog::putSigned(fileBuffer, record.time - lastTimestamp);
+				BinaryLog::putVarint(fileBuffer, count);
+				fileBuffer += arguments;
+			} else {
+				BinaryLog::putTag(fileBuffer, BinaryLog::Entry::TextRecord);
+				BinaryLog::putVarint(fileBuffer, logger);
+				fileBuffer.push_back(static_cast<char>(record.style->severity));
+				BinaryLog::putSigned(fileBuffer, record.time - lastTimestamp);
+				std::string text = StringConverter::toUtf8(record.message());
+				const bool empty = text.empty();
+				FieldCodec::appendLogfmt(text, record.encodedFields);
+				if (empty && !text.empty()) text.erase(0, 1);
+				BinaryLog::putString(fileBuffer, text);
+			}
+			lastTimestamp = record.time;
 		}
 
-		// Rename the existing latest.log to a dated backup file with the format YYYY-MM-DD-N.log.
-		static void rotateLogFiles(const std::tm &time) {
+	public:
+		FileSink() : siteCount(0), generation(0), lastTimestamp(0), clockSecond(0), utcOffset(0), precision(TimePrecision::Seconds), clockWritten(false) {}
+#else
+	public:
+#endif
+		void write([[maybe_unused]] const LogRecord &record) override {
 #ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-			if (!std::filesystem::exists(latestLog)) return;
-
-			std::tm fileTime{};
-			struct stat fileStat;
-			if (stat(latestLog.string().c_str(), &fileStat)) fileTime = time;
-#ifdef _WIN32
-			else localtime_s(&fileTime, &fileStat.st_mtime);
+			TimeUtils::updateCache(record.time);
+			// A rotation writes the buffered output to the previous file.
+			const size_t buffered = fileBuffer.size();
+			FileLogger::updateIfNeeded();
+			if (fileBuffer.size() < buffered) increase(writtenBytes, buffered);
+			if (!logFile.is_open()) return;
+#ifdef KLY_LOGGER_OPTION_BINARY_LOG_FILE
+			writeBinaryRecord(record);
 #else
-			else localtime_r(&fileStat.st_mtime, &fileTime);
+			MessageProcessor::writeFileMessage(*record.logger, record.message(), *record.style, record.time, record.encodedFields);
 #endif
-			// Find the first available filename in the format YYYY-MM-DD-N.log
-			// Increment 'i' until a non-existing filename is found.
-			unsigned i = 1;
-			std::wstring newFilename;
-			do {
-				newFilename = std::format(L"{}/{:04}-{:02}-{:02}-{}.log", logsDirectory.wstring(), fileTime.tm_year + 1900, fileTime.tm_mon + 1, fileTime.tm_mday, i++);
-			} while (std::filesystem::exists(newFilename));
-
-			std::filesystem::rename(latestLog, newFilename);
 #endif
 		}
-	};
 
-	// Time utilities.
-	class TimeUtils {
-	public:
-		// Retrieve the current local time.
-		static std::tm getLocalTime() {
-			const time_t now = time(nullptr);
-			std::tm result{};
-#ifdef _WIN32
-			localtime_s(&result, &now);
+		void flush() override { FileLogger::flush(); }
+
+		void sync() override { FileLogger::sync(); }
+
+		[[nodiscard]] size_t bufferedBytes() const override {
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+			return fileBuffer.size();
 #else
-			localtime_r(&now, &result);
+			return 0;
 #endif
-			return result;
 		}
+	};
 
-		// Format time structure to %H:%M:%S string.
-		static std::wstring formatTime(const std::tm &time) {
-			return std::format(L"{:02}:{:02}:{:02} ", time.tm_hour, time.tm_min, time.tm_sec);
+	// Sink calling the function registered with setAfterLog() for every line.
+	class AfterLogSink : public Sink {
+	public:
+		void write(const LogRecord &record) override {
+			if (!afterLog && !afterLogFields) return;
+			const auto begin = std::chrono::steady_clock::now();
+			const OutputView text = record.message();
+			OutputString plain;
+			std::vector<LogField> fields;
+			if (afterLogFields) fields = record.fields();
+			MessageProcessor::forEachLine(text, [&](size_t start) {
+				plain.clear();
+				const size_t end = ConsoleHelper::appendPlainLine(text, start, plain);
+				if (afterLogFields) afterLogFields(StringConverter::toWide(text.substr(start, end - start)), StringConverter::toWide(plain), fields);
+				else afterLog(StringConverter::toWide(text.substr(start, end - start)), StringConverter::toWide(plain));
+				return end;
+			});
+			callbackNanoseconds.fetch_add(static_cast<std::uint64_t>((std::chrono::steady_clock::now() - begin).count()), std::memory_order_relaxed);
 		}
 	};
 
-	// Log message processor.
-	class MessageProcessor {
-	public:
-		// Process complete log message including line splitting.
-		static void processMessage(const std::wstring &name, std::wstring message, const LogStyle &style) {
-			size_t newlinePos;
-			while ((newlinePos = findNextNewline(message)) != std::wstring::npos) {
-				processSingleLine(name, message.substr(0, newlinePos), style);
-				message = message.substr(newlinePos + 1);
-			}
+	// Queue and state of a sink that writes on its own thread.
+	struct SinkWriter {
+		// Record copied for the writer thread.
+		struct QueuedRecord {
+			const LogStyle *style;
+			LoggerEntry *logger;
+			std::int64_t timestamp;
+			OutputString message;
+			std::string fields;
+		};
 
-			if (!message.empty()) processSingleLine(name, message, style);
-		}
+		RingBuffer<QueuedRecord, KLY_LOGGER_OPTION_SINK_QUEUE_CAPACITY> queue;
+		// Number of records pushed to the queue and number of records written or evicted.
+		std::atomic_size_t accepted, completed;
+		// Set when the sink is removed, the writer thread exits once the queue is empty. Set by the writer thread when it exits.
+		std::atomic_bool stopping, exited;
+		// Number of syncs asked for by flush() and number of syncs done.
+		std::atomic_size_t syncRequests, syncs;
+		// Signalled when records are queued, when queue slots are freed, when records are completed and when the writer syncs or exits.
+		Notifier queueNotifier, spaceNotifier, completionNotifier;
+		const OverflowPolicy overflowPolicy;
+
+		explicit SinkWriter(OverflowPolicy overflowPolicy) noexcept : overflowPolicy(overflowPolicy) {}
+	};
 
-		// Find position of next newline character (CR/LF).
-		static size_t findNextNewline(const std::wstring &str) {
-			const size_t crPos = str.find(L'\r'), lfPos = str.find(L'\n');
+	// A sink in the record stream, with its writer if it has its own thread.
+	struct SinkSlot {
+		std::shared_ptr<Sink> sink;
+		std::shared_ptr<SinkWriter> writer;
+	};
 
-			if (crPos == std::wstring::npos) return lfPos;
-			if (lfPos == std::wstring::npos) return crPos;
+	using SinkList = std::vector<SinkSlot>;
 
-			return std::min(crPos, lfPos);
-		}
+	// Per-call-site rate limit of RateLimitPolicy, checked on the calling thread before the message is formatted.
+	// A call site is a format marked with literal() together with its level and logger. Every site is a token bucket kept
+	// as a single time (GCRA): the time at which its bucket is full again, so a check costs one compare-and-swap.
+	// Sites live in a fixed lock-free table, sites that find no free entry are not limited.
+	class RateLimiter {
+		static constexpr size_t CAPACITY = 1024;
+		static constexpr size_t MAX_PROBES = 16;
 
-		// Process single line of log message with formatting.
-		static void processSingleLine(const std::wstring &name, const std::wstring &message, const LogStyle &style) {
-			if (message.empty()) return;
-			if (beforeLog) {
-				try {
-					beforeLog();
-				} catch (...) {
+		struct Site {
+			// Hash of the format address, level and logger of the call site, zero while the entry is free.
+			std::atomic_uint64_t key;
+			// Set once the fields describing the call site are filled in.
+			std::atomic_bool ready;
+			// Time at which the bucket is full again, on the clock of log records.
+			std::atomic<std::int64_t> fullAt;
+			// Calls discarded since the last report.
+			std::atomic_size_t suppressed;
+			const LogStyle *style;
+			LoggerEntry *logger;
+			const void *address;
+			// Copy of the format for the report, made once when the entry is claimed.
+			OutputString format;
+		};
+
+		static inline Site sites[CAPACITY];
+		// Time the bucket takes to gain one record and time it may be ahead of the current time, zero disables the limit.
+		static inline std::atomic<std::int64_t> interval, tolerance;
+		// Whether any site has discarded calls that have not been reported yet.
+		static inline std::atomic_bool pending;
+
+		// Find the entry of a call site, claiming a free one if it has none yet. Returns nullptr if the table is crowded
+		// or the entry is still being claimed by another thread, the call is not limited then.
+		template<typename Char>
+		static Site *find(std::uint64_t key, const LogStyle &style, LoggerEntry *logger, StringConverter::Literal<Char> format) noexcept {
+			size_t index = static_cast<size_t>(key * 0x9E3779B97F4A7C15ull >> (64 - std::countr_zero(CAPACITY)));
+			for (size_t probe = 0; probe < MAX_PROBES; probe++, index = (index + 1) & (CAPACITY - 1)) {
+				Site &site = sites[index];
+				std::uint64_t current = site.key.load(std::memory_order_acquire);
+				if (!current && site.key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+					site.style = &style;
+					site.logger = logger;
+					site.address = format.text;
+					try {
+						site.format = StringConverter::toOutput(std::basic_string_view<Char>(format.text));
+					} catch (...) {
+					}
+					site.ready.store(true, std::memory_order_release);
+					return &site;
 				}
+				if (current != key) continue;
+				if (!site.ready.load(std::memory_order_acquire)) return nullptr;
+				// Different call sites with the same hash take separate entries.
+				if (site.address == format.text && site.style == &style && site.logger == logger) return &site;
 			}
-			printTimeStamp(name, style);
-			const std::wstring stripped = ConsoleHelper::processColorCodes(message, style.textColor, style.textAnsiColor, afterLog != nullptr);
-			if (afterLog) {
-				try {
-					afterLog(message, stripped);
-				} catch (...) {
+			return nullptr;
+		}
+
+	public:
+		static void configure(double recordsPerSecond, size_t burst) noexcept {
+			const std::int64_t step = recordsPerSecond > 0 ? std::max<std::int64_t>(1, static_cast<std::int64_t>(1e9 / recordsPerSecond)) : 0;
+			tolerance.store(step * static_cast<std::int64_t>(std::max<size_t>(burst, 1) - 1), std::memory_order_relaxed);
+			interval.store(step, std::memory_order_relaxed);
+		}
+
+		// Whether a call may be logged, counts it as suppressed otherwise. FATAL records are never limited.
+		// Call sites are told apart by the address of their literal format, their level and their logger.
+		template<typename Char>
+		static bool allow(const LogStyle &style, LoggerEntry *logger, StringConverter::Literal<Char> format, std::int64_t now) noexcept {
+			const std::int64_t step = interval.load(std::memory_order_relaxed);
+			if (!step || style.severity == LogLevel::Fatal) return true;
+			std::uint64_t key = (static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(format.text)) * 0xFF51AFD7ED558CCDull) ^
+					(static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(logger)) * 0xC4CEB9FE1A85EC53ull) ^ static_cast<std::uint64_t>(style.severity);
+			key ^= key >> 33;
+			Site *site = find(key ? key : 1, style, logger, format);
+			if (!site) return true;
+
+			const std::int64_t limit = now + tolerance.load(std::memory_order_relaxed);
+			std::int64_t fullAt = site->fullAt.load(std::memory_order_relaxed);
+			do {
+				if (fullAt > limit) {
+					site->suppressed.fetch_add(1, std::memory_order_seq_cst);
+					if (!pending.load(std::memory_order_relaxed)) pending.store(true, std::memory_order_seq_cst);
+					return false;
+				}
+			} while (!site->fullAt.compare_exchange_weak(fullAt, std::max(fullAt, now) + step, std::memory_order_relaxed));
+			return true;
+		}
+
+		[[nodiscard]] static bool hasPending() noexcept { return pending.load(std::memory_order_relaxed); }
+
+		// Output how many calls each call site discarded, once its bucket is full again or unconditionally when final (logging thread only).
+		static void report(const SinkList &list, std::int64_t now, bool final) {
+			pending.store(false, std::memory_order_seq_cst);
+			bool waiting = false;
+			for (Site &site : sites) {
+				if (!site.suppressed.load(std::memory_order_seq_cst)) continue;
+				if (!site.ready.load(std::memory_order_acquire) || (!final && site.fullAt.load(std::memory_order_relaxed) > now)) {
+					waiting = true;
+					continue;
 				}
+				const size_t count = site.suppressed.exchange(0, std::memory_order_relaxed);
+				const OutputString text = StringConverter::toOutput(std::format("Suppressed {} calls over the rate limit: ", count)) + site.format;
+				dispatch(list, LogRecord(site.style, site.logger, now, text));
 			}
-			ConsoleHelper::clearLine();
-			ConsoleHelper::flushLine();
+			if (waiting) pending.store(true, std::memory_order_relaxed);
 		}
+	};
 
-		// Print current time and logger name (if provided).
-		static void printTimeStamp(const std::wstring &name, const LogStyle &style) {
-			// Get current local time for timestamp.
-			const std::tm localTime = TimeUtils::getLocalTime();
+	// Output a record to a sink, errors thrown by a sink are ignored.
+	static void writeToSink(Sink &sink, const LogRecord &record) noexcept {
+		try {
+			sink.write(record);
+		} catch (...) {
+		}
+		increase(sink.writtenRecords, 1);
+	}
 
-			// Set cyan color for timestamp bracket if output is terminal.
-			if (isAtty) ConsoleHelper::setColor(3, "\33[0;36m");
+	// Write the buffered output of a sink, errors thrown by a sink are ignored.
+	static void flushSink(Sink &sink) noexcept {
+		try {
+			const size_t bytes = sink.bufferedBytes();
+			sink.flush();
+			if (bytes) increase(sink.writtenBytes, bytes);
+		} catch (...) {
+		}
+	}
 
-			ConsoleHelper::write("\r[");
-			ConsoleHelper::setColor(3, "\33[0;36m");
-			// Write formatted time (HH:MM:SS).
-			ConsoleHelper::write(TimeUtils::formatTime(localTime));
-			// Set level-specific color for level text.
-			ConsoleHelper::setColor(style.levelColor, style.levelAnsiColor);
-			ConsoleHelper::write(style.level);
-			// Reset to cyan for closing bracket.
-			ConsoleHelper::setColor(3, "\33[0;36m");
-			ConsoleHelper::write("] ");
+	// Store the output of a sink durably, errors thrown by a sink are ignored.
+	static void syncSink(Sink &sink) noexcept {
+		try {
+			sink.sync();
+		} catch (...) {
+		}
+	}
 
-			// Add logger name section if name is not empty.
-			if (!name.empty()) {
-				ConsoleHelper::write("[");
-				// Process color codes in logger name.
-				ConsoleHelper::processColorCodes(name, 3, "\33[0;36m", false);
-				ConsoleHelper::setColor(3, "\33[0;36m");
-				ConsoleHelper::write("] ");
+	// Pass a record to every sink whose level it reaches (logging thread only).
+	static void dispatch(const SinkList &list, const LogRecord &record) {
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+		// The writer process of the shared ring outputs the records of every other process.
+		if (SharedRing::forward(record)) return;
+#endif
+		// The console sink calls the setBeforeLog() function before every line, on the thread that outputs it. For records
+		// the console sink does not take, the function runs once here, before the first sink that takes them.
+		bool announced = std::ranges::any_of(list, [&record](const SinkSlot &slot) { return slot.sink == builtinConsoleSink && slot.sink->isEnabled(record.style->severity); });
+		for (const SinkSlot &slot : list) {
+			if (!slot.sink->isEnabled(record.style->severity)) continue;
+			if (!std::exchange(announced, true)) MessageProcessor::callBeforeLog();
+			if (!slot.writer) writeToSink(*slot.sink, record);
+			else pushToWriter(*slot.sink, *slot.writer, SinkWriter::QueuedRecord{record.style, record.logger, record.time, OutputString(record.message()), std::string(record.encodedFields)});
+		}
+	}
+
+	// Pass the record of a log task to the sinks, unless it repeats the previous record and repeats are collapsed (logging thread only).
+	static void dispatch(const SinkList &list, LogTask &task) {
+		const LogRecord record(task.style, task.logger, task.timestamp, task.message);
+		if (collapseRepeats.load(std::memory_order_relaxed)) {
+			if (record.style == repeatedStyle && record.logger == repeatedLogger && record.message() == repeatedMessage && record.encodedFields == repeatedFields) {
+				repeatCount++;
+				lastRepeatTime = record.time;
+				return;
 			}
+			reportRepeats(list);
+			repeatedStyle = record.style;
+			repeatedLogger = record.logger;
+			repeatedMessage.assign(record.message());
+			repeatedFields.assign(record.encodedFields);
+		}
+		dispatch(list, record);
+	}
 
-			// Set final text color for the actual log message.
-			ConsoleHelper::setColor(style.textColor, style.textAnsiColor);
+	// Output how often the previous record has been repeated since it was output (logging thread only).
+	static void reportRepeats(const SinkList &list) {
+		if (!repeatCount) return;
+		const OutputString text = StringConverter::toOutput(std::format("Last message repeated {} times", std::exchange(repeatCount, 0)));
+		dispatch(list, LogRecord(repeatedStyle, repeatedLogger, lastRepeatTime, text));
+	}
+
+	// Output the counts of collapsed repeats and of calls discarded by the rate limit once they are due, or all of them when final.
+	// Returns how long until the next count is due, negative if none is waiting (logging thread only).
+	static std::chrono::nanoseconds reportSuppressed(const SinkList &list, bool final) {
+		if (!repeatCount && !RateLimiter::hasPending()) return -1ns;
+		const std::int64_t now = TimeUtils::now();
+		bool reported = false;
+		std::chrono::nanoseconds due(-1);
+		if (repeatCount) {
+			if (final || !collapseRepeats.load(std::memory_order_relaxed) || now - lastRepeatTime >= SUMMARY_DELAY) {
+				reportRepeats(list);
+				repeatedStyle = nullptr;
+				reported = true;
+			} else due = std::chrono::nanoseconds(lastRepeatTime + SUMMARY_DELAY - now);
 		}
-	};
+		if (RateLimiter::hasPending()) {
+			if (final || now >= nextSuppressionReport) {
+				RateLimiter::report(list, now, final);
+				nextSuppressionReport = now + SUMMARY_DELAY;
+				reported = true;
+			}
+			if (RateLimiter::hasPending()) {
+				const std::chrono::nanoseconds wait(nextSuppressionReport - now);
+				due = due < 0ns ? wait : std::min(due, wait);
+			}
+		}
+		if (reported) flushOutput(list);
+		return due;
+	}
 
-	// Yield execution and sleep briefly to reduce busy-wait CPU usage.
-	static void pauseBriefly() {
-		std::this_thread::yield();
-		std::this_thread::sleep_for(1ms);
+	// Output the statistics line once it is due, as key=value pairs for log scrapers.
+	// Returns how long until the next one is due, negative if it is turned off (logging thread only).
+	static std::chrono::nanoseconds reportStats(const SinkList &list) {
+		const std::chrono::milliseconds interval(statsInterval.load(std::memory_order_relaxed));
+		if (interval <= 0ms) {
+			nextStatsReport = {};
+			return -1ns;
+		}
+		const auto now = std::chrono::steady_clock::now();
+		if (nextStatsReport == std::chrono::steady_clock::time_point()) nextStatsReport = now + interval;
+		if (now < nextStatsReport) return nextStatsReport - now;
+		nextStatsReport = now + interval;
+
+		const Stats current = stats();
+		const auto micros = [](std::chrono::nanoseconds time) { return static_cast<double>(time.count()) / 1e3; };
+		std::string text = std::format("Stats: enqueued={} written={} dropped={} queue_depth={} queue_high_water={} latency_p50_us={:.1f} latency_p99_us={:.1f} "
+				"latency_p999_us={:.1f} rotations={} rotation_ms={:.3f} callback_ms={:.3f} priority_boosts={}", current.enqueued, current.written, current.dropped,
+				current.queueDepth, current.queueHighWater, micros(current.latency.percentile(0.5)), micros(current.latency.percentile(0.99)),
+				micros(current.latency.percentile(0.999)), current.rotations, micros(current.rotationTime) / 1e3, micros(current.callbackTime) / 1e3,
+				current.priorityBoosts);
+		for (size_t i = 0; i < current.sinks.size(); i++) {
+			const SinkStats &sink = current.sinks[i];
+			const std::string name = sink.sink == builtinConsoleSink ? "console" : sink.sink == builtinFileSink ? "file" : std::format("sink{}", i);
+			std::format_to(std::back_inserter(text), " {0}_records={1} {0}_bytes={2} {0}_dropped={3}", name, sink.records, sink.bytes, sink.dropped);
+		}
+		static LoggerEntry *const logger = internLoggerName(L"KlyLogger");
+		dispatch(list, LogRecord(&INFO_STYLE, logger, TimeUtils::now(), StringConverter::toOutput(text)));
+		flushOutput(list);
+		return interval;
+	}
+
+	// Queue a record for a sink with its own thread, applying the overflow policy of the sink when its queue is full.
+	static void pushToWriter(Sink &sink, SinkWriter &writer, SinkWriter::QueuedRecord &&record) {
+		while (!writer.queue.tryPush(std::move(record))) {
+			if (writer.overflowPolicy == OverflowPolicy::OverwriteOldest) {
+				if (writer.queue.tryPop()) {
+					sink.dropped.fetch_add(1, std::memory_order_relaxed);
+					writer.completed.fetch_add(1, std::memory_order_release);
+					writer.completionNotifier.notify();
+				}
+			} else if (writer.overflowPolicy == OverflowPolicy::DropNewest) {
+				sink.dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			} else writer.spaceNotifier.waitUntil([&writer] { return !writer.queue.full(); }, -1ns);
+		}
+		writer.accepted.fetch_add(1, std::memory_order_release);
+		writer.queueNotifier.notify();
+	}
+
+	// Restrict the current thread to the CPUs of a scheduling policy, or to those of the process if it names none.
+	static void applyAffinity(const SchedulingPolicy &policy) noexcept {
+#ifdef _WIN32
+		DWORD_PTR mask = 0, systemMask = 0;
+		for (const unsigned cpu : policy.cpus)
+			if (cpu < sizeof(DWORD_PTR) * 8) mask |= static_cast<DWORD_PTR>(1) << cpu;
+		if (!mask) GetProcessAffinityMask(GetCurrentProcess(), &mask, &systemMask);
+		if (mask) SetThreadAffinityMask(GetCurrentThread(), mask);
+#else
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (const unsigned cpu : policy.cpus)
+			if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+		if (!CPU_COUNT(&set) && sched_getaffinity(getpid(), sizeof(set), &set) != 0) return;
+		sched_setaffinity(0, sizeof(set), &set);
+#endif
+	}
+
+	// Set the priority of the current thread from a scheduling policy, the boosted one if `boosted`.
+	// Returns whether every setting was applied, failures (e.g. raising the priority without permission) leave that setting as it was.
+	static bool applyPriority(const SchedulingPolicy &policy, bool boosted) noexcept {
+		const int nice = std::clamp(boosted ? policy.boostNiceValue : policy.niceValue, -20, 19);
+#ifdef _WIN32
+		return SetThreadPriority(GetCurrentThread(), nice >= 19 ? THREAD_PRIORITY_IDLE : nice >= 10 ? THREAD_PRIORITY_LOWEST : nice > 0 ? THREAD_PRIORITY_BELOW_NORMAL
+				: nice == 0 ? THREAD_PRIORITY_NORMAL : nice > -10 ? THREAD_PRIORITY_ABOVE_NORMAL : nice > -20 ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+		using Class = SchedulingPolicy::Class;
+		sched_param param{};
+		int scheduler = SCHED_OTHER;
+		if (policy.schedulingClass == Class::Fifo || policy.schedulingClass == Class::RoundRobin) {
+			scheduler = policy.schedulingClass == Class::Fifo ? SCHED_FIFO : SCHED_RR;
+			param.sched_priority = std::clamp(policy.realtimePriority, sched_get_priority_min(scheduler), sched_get_priority_max(scheduler));
+		} else if (!boosted && policy.schedulingClass == Class::Batch) scheduler = SCHED_BATCH;
+		else if (!boosted && policy.schedulingClass == Class::Idle) scheduler = SCHED_IDLE;
+		const bool scheduled = sched_setscheduler(0, scheduler, &param) == 0;
+		return setpriority(PRIO_PROCESS, gettid(), nice) == 0 && scheduled;
+#endif
+	}
+
+	// Apply the scheduling policy to the current thread if it changed since version `applied` (logging threads only).
+	// Returns whether it did, the thread then runs at the unboosted priority.
+	static bool updateScheduling(std::shared_ptr<const SchedulingPolicy> &policy, size_t &applied) {
+		const size_t version = schedulingVersion.load(std::memory_order_acquire);
+		if (version == applied) return false;
+		applied = version;
+		policy = schedulingPolicy.load();
+		applyAffinity(*policy);
+		applyPriority(*policy, false);
+		return true;
 	}
 
-	// Thread lock manager.
-	class LockManager {
-	public:
-		// Spin until the lock is acquired.
-		static void acquire() {
-			for (bool expected = false; !lockFlag.compare_exchange_weak(expected, true, std::memory_order_acquire); expected = false)
-				pauseBriefly();
+	// Body of the writer thread of a sink, flushes the sink whenever its queue is drained.
+	static void runSinkWriter(const std::shared_ptr<Sink> &sink, const std::shared_ptr<SinkWriter> &writer) {
+		setLowestThreadPriority();
+		isLoggingThread = true;
+		std::shared_ptr<const SchedulingPolicy> scheduling;
+		size_t schedulingApplied = 0;
+		while (true) {
+			updateScheduling(scheduling, schedulingApplied);
+			size_t written = 0;
+			while (std::optional<SinkWriter::QueuedRecord> record = writer->queue.tryPop()) {
+				writer->spaceNotifier.notify();
+				writeToSink(*sink, LogRecord(record->style, record->logger, record->timestamp, record->message, record->fields));
+				sink->latency.add(TimeUtils::now() - record->timestamp);
+				written++;
+
+				const bool isError = record->style->severity >= LogLevel::Error;
+				if ((isError && flushOnError.load(std::memory_order_relaxed)) || sink->bufferedBytes() >= flushMaxBytes.load(std::memory_order_relaxed)) {
+					flushSink(*sink);
+					writer->completed.fetch_add(std::exchange(written, 0), std::memory_order_release);
+					writer->completionNotifier.notify();
+				}
+			}
+			flushSink(*sink);
+			writer->completed.fetch_add(written, std::memory_order_release);
+			// Store the output on disk when flush() asked for it.
+			if (const size_t requests = writer->syncRequests.load(std::memory_order_acquire); requests != writer->syncs.load(std::memory_order_relaxed)) {
+				syncSink(*sink);
+				writer->syncs.store(requests, std::memory_order_release);
+			}
+			const bool exiting = writer->stopping.load() && writer->queue.empty();
+			if (exiting) writer->exited.store(true, std::memory_order_release);
+			writer->completionNotifier.notify();
+			if (exiting) return;
+
+			writer->queueNotifier.waitUntil([&writer] {
+				return !writer->queue.empty() || writer->stopping.load() || writer->syncRequests.load(std::memory_order_relaxed) != writer->syncs.load(std::memory_order_relaxed);
+			}, -1ns);
 		}
+	}
 
-		// Release the custom lock.
-		static void release() { lockFlag.store(false, std::memory_order_release); }
-
-		// Execute function with automatic lock acquisition and release.
-		template<typename Func>
-		static void execute(const Func &&operation) {
-			acquire();
-			operation();
-			release();
-		}
-	};
+	// Replace the sink list with a changed copy, the logging thread picks it up with the next record.
+	template<typename Change>
+	static void updateSinks(Change &&change) {
+		std::shared_ptr<const SinkList> current = sinks.load();
+		std::shared_ptr<SinkList> next;
+		do {
+			next = std::make_shared<SinkList>(*current);
+			change(*next);
+		} while (!sinks.compare_exchange_weak(current, next));
+		sinksVersion.fetch_add(1, std::memory_order_release);
+	}
 
-	// Thread lock flag (mutex was avoided because on some devices it caused unexpected crashes).
-	static inline std::atomic_bool lockFlag;
-	// Log task queue, stores log tasks to be processed by the logging thread.
-	static inline std::queue<LogTask> logQueue;
+	// Log task queue, stores log tasks to be processed by the logging thread
+	// (lock-free, mutex was avoided because on some devices it caused unexpected crashes).
+	static inline RingBuffer<LogTask, KLY_LOGGER_OPTION_QUEUE_CAPACITY> logQueue;
+	// Number of tasks accepted into the queue (see Stats::enqueued).
+	static inline std::atomic_size_t enqueuedTasks;
+	// Number of tasks submitted to the queue, counted before they are pushed, and number of tasks that are done with:
+	// written, evicted or dropped. wait() waits for the second to catch up with the first.
+	static inline std::atomic_size_t submittedTasks, completedTasks;
+	// Number of log records discarded because the queue was full.
+	static inline std::atomic_size_t droppedRecords;
+	// Statistics of the logging thread: records passed to the sinks, their latency and the most tasks ever queued (see Stats).
+	static inline std::atomic_uint64_t writtenRecords;
+	static inline LatencyCounter writeLatency;
+	static inline std::atomic_size_t queueHighWater;
+	// Number of log file rotations and the time they took, and the time spent in the beforeLog and afterLog callbacks.
+	static inline std::atomic_uint64_t rotationCount, rotationNanoseconds, callbackNanoseconds;
+	// Interval of the statistics line in milliseconds (zero: none) and when the logging thread outputs the next one.
+	static inline std::atomic<std::chrono::milliseconds::rep> statsInterval;
+	static inline std::chrono::steady_clock::time_point nextStatsReport;
+	// Policy applied when the log queue is full.
+	static inline std::atomic<OverflowPolicy> overflowPolicy{OverflowPolicy::Block};
+	// Flush policy fields, stored separately so they can be changed while the logging thread runs.
+	static inline std::atomic_size_t flushMaxBytes{64 * 1024};
+	static inline std::atomic<std::chrono::milliseconds::rep> flushMaxDelay{0};
+	static inline std::atomic_bool flushOnError{true};
+	// Rotation policy fields, changes are picked up by the logging thread with the next record.
+	static inline std::atomic<std::uintmax_t> rotateMaxBytes, retainMaxBytes;
+	static inline std::atomic_size_t retainMaxFiles;
+	static inline std::atomic_bool rotationPolicyChanged;
+	// RateLimitPolicy::collapseRepeats, changes are picked up by the logging thread with the next record.
+	static inline std::atomic_bool collapseRepeats;
+	// Scheduling policy of the logging threads (null until one is set) and a counter incremented whenever it changes,
+	// each thread applies it to itself with its next record. Number of times the logging thread raised its priority.
+	static inline std::atomic<std::shared_ptr<const SchedulingPolicy>> schedulingPolicy;
+	static inline std::atomic_size_t schedulingVersion;
+	static inline std::atomic_uint64_t priorityBoosts;
+	// Quiet time after which the counts of collapsed repeats and of calls discarded by the rate limit are output, in nanoseconds.
+	static constexpr std::int64_t SUMMARY_DELAY = 1000000000;
+	// Record that following records are compared with, how often it has been repeated since it was output and when (logging thread only).
+	static inline const LogStyle *repeatedStyle;
+	static inline LoggerEntry *repeatedLogger;
+	static inline OutputString repeatedMessage;
+	static inline std::string repeatedFields;
+	static inline size_t repeatCount;
+	static inline std::int64_t lastRepeatTime;
+	// Earliest time the logging thread outputs the next counts of calls discarded by the rate limit.
+	static inline std::int64_t nextSuppressionReport;
+	// Set by wait() to make the logging thread write buffered output without waiting for the flush policy.
+	static inline std::atomic_bool flushRequested;
+	// Number of syncs asked for by flush() and number of syncs done by the logging thread.
+	static inline std::atomic_size_t syncRequests, completedSyncs;
+	// Set by shutdown() to make the logging thread exit once the queue is drained, and by the logging thread when it exits.
+	static inline std::atomic_bool stopRequested, loggingThreadExited;
+	// Claimed by whoever joins or detaches the logging thread.
+	static inline std::atomic_flag loggingThreadReleased;
+#ifndef _WIN32
+	// Process that started the logging thread, a child forked without exec has none of the threads of its parent.
+	static inline pid_t loggingThreadProcess;
+#endif
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+	// Held by a thread calling fork() until the parent and the child resume, set while the logging thread is asked to pause for it.
+	static inline std::atomic_flag forkLock;
+	static inline std::atomic_bool forkRequested;
+	// Number of forks that asked the logging thread to pause and the last one it paused for.
+	static inline std::atomic_size_t forkRequests, forkAcknowledged;
+#endif
+	// Longest time normal process exit waits for the logging thread, in milliseconds (negative waits as long as it takes).
+	static inline std::atomic<std::chrono::milliseconds::rep> exitTimeout{5000};
+	// Signalled when tasks are queued, when queue slots are freed and when tasks are completed.
+	static inline Notifier queueNotifier, spaceNotifier, completionNotifier;
+	// Offset added to the monotonic clock to obtain wall-clock time, recalibrated by the logging thread.
+	static inline std::atomic<std::int64_t> clockOffset{TimeUtils::measureClockOffset()};
+	// Resolution of the time shown in the log header.
+	static inline std::atomic<TimePrecision> timePrecision{TimePrecision::Seconds};
+	// Cached local time of the second currently being logged, refreshed once per second by the thread formatting times.
+	static inline thread_local std::int64_t cachedSecond = INT64_MIN, nextClockCalibration;
+	static inline thread_local std::tm cachedLocalTime;
+	static inline thread_local std::string cachedTimeText;
+	// Head of the lock-free list of interned logger names.
+	static inline std::atomic<LoggerEntry *> loggerRegistry;
+	// Marks the logging thread, which must never block on its own queue (e.g. when callbacks log).
+	static inline thread_local bool isLoggingThread = false;
+	// Buffer the calling thread formats messages into, kept to avoid an allocation per call, and whether it is in use.
+	static inline thread_local OutputString formatBuffer;
+	static inline thread_local bool formatBufferBusy = false;
+	// Reusable buffer encoding the fields of a log call, and whether it is in use further up the stack.
+	static inline thread_local std::string fieldBuffer;
+	static inline thread_local bool fieldBufferBusy = false;
+	// Built-in sinks and the sink list, replaced as a whole when sinks are added or removed.
+	static inline const std::shared_ptr<Sink> builtinConsoleSink = std::make_shared<ConsoleSink>(), builtinFileSink = std::make_shared<FileSink>();
+	static inline std::atomic<std::shared_ptr<const SinkList>> sinks{std::make_shared<const SinkList>(SinkList{
+			{builtinConsoleSink, nullptr}, {builtinFileSink, nullptr}, {std::make_shared<AfterLogSink>(), nullptr}})};
+	// Incremented whenever the sink list changes.
+	static inline std::atomic_size_t sinksVersion;
 	// Code to execute before a log message has been output.
 	static inline std::function<void()> beforeLog;
 	// Code to execute after a log message has been output.
 	static inline std::function<void(const std::wstring &, const std::wstring &)> afterLog;
+	static inline std::function<void(const std::wstring &, const std::wstring &, const std::vector<LogField> &)> afterLogFields;
 	// Detect whether the process has a terminal.
 	// If not (e.g., output redirected to a file), console output will be disabled.
 	static inline const bool isAtty = isatty(fileno(stderr));
 	// Determines whether the current console supports ANSI escape sequences.
 	static inline const bool ansiSupported = ConsoleHelper::initialize();
+#ifndef KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER
+	// Whether the crash handlers of the flight recorder are registered.
+	static inline const bool flightRecorderInstalled = FlightRecorder::install();
+#endif
 
 #ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
 	// Record the date when the log file was created.
 	static inline unsigned logFileCreateDate;
 	// Log file handle.
-	static inline std::ofstream logFile;
+	static inline LogFile logFile;
+	// Log file content waiting to be written.
+	static inline std::string fileBuffer;
 	// Directory and file path of log files.
 	static inline std::filesystem::path logsDirectory, latestLog;
+	// Number of bytes written to the current log file.
+	static inline std::uintmax_t logFileSize;
+	// Incremented whenever a log file is opened, so that the binary format can start each file with its own dictionary.
+	static inline size_t logFileGeneration;
+	// Date (YYYYMMDD) of the most recent backup and the next free backup index on that date (logging thread only).
+	static inline unsigned backupDate, nextBackupIndex;
+	// Worker that compresses and prunes backups, joined by shutdown().
+	static inline std::thread maintenanceThread;
+	// Whether the maintenance worker runs, whether it has work to do, whether shutdown() asked it to exit and whether it has exited.
+	static inline std::atomic_bool maintenanceStarted, maintenanceRequested, maintenanceStopping, maintenanceExited;
+	// Signalled when the maintenance worker has work to do or has exited.
+	static inline Notifier maintenanceNotifier;
 #endif
 
 	// Cache buffer when ANSI escape sequences are enabled.
 	// Output only complete lines to reduce output frequency.
-	static inline std::wstring lineBuffer;
+	static inline OutputString lineBuffer;
+	// Completed console lines waiting to be written in a single call.
+	static inline OutputString consoleBuffer;
+	// Console output in a StreamFormat, as UTF-8 waiting to be written in a single call.
+	static inline std::string streamBuffer;
+	// Console output when stderr is not a terminal.
+	static inline std::atomic<StreamFormat> streamFormat{StreamFormat::None};
+	// Form of the log file records and their kv() fields.
+	static inline std::atomic<FieldFormat> fieldFormat{FieldFormat::Logfmt};
 	// Logger name as wide string.
 	const std::wstring name{}, as_wstring{};
 	// Logger name as simple string.
 	const std::string as_string{};
+	// Interned registry entry holding the pre-rendered headers of this logger.
+	LoggerEntry *const entry;
+	// Lowest level this logger outputs, can be changed while the program runs.
+	std::atomic<LogLevel> threshold{LogLevel::Trace};
+
+	// Number of processed tasks whose output is still buffered (logging thread only).
+	static inline size_t bufferedTasks;
+	// When the oldest buffered task was processed (logging thread only).
+	static inline std::chrono::steady_clock::time_point bufferedSince;
+
+	// Store the output of the sinks written by the logging thread on disk.
+	static void syncOutput(const SinkList &list) {
+		for (const SinkSlot &slot : list) {
+			if (!slot.writer) syncSink(*slot.sink);
+		}
+	}
+
+	// Write all buffered output of the sinks written by the logging thread and mark the tasks it contains as completed.
+	static void flushOutput(const SinkList &list) {
+		for (const SinkSlot &slot : list) {
+			if (!slot.writer) flushSink(*slot.sink);
+		}
+		completedTasks.fetch_add(bufferedTasks, std::memory_order_release);
+		bufferedTasks = 0;
+		completionNotifier.notify();
+	}
+
+	// Number of bytes currently buffered by the sinks written by the logging thread.
+	static size_t bufferedBytes(const SinkList &list) noexcept {
+		size_t bytes = 0;
+		for (const SinkSlot &slot : list) {
+			if (!slot.writer) bytes += slot.sink->bufferedBytes();
+		}
+		return bytes;
+	}
+
+	// Point in time a timeout ends, negative timeouts never end.
+	static std::chrono::steady_clock::time_point deadlineAfter(std::chrono::nanoseconds timeout) noexcept {
+		const auto now = std::chrono::steady_clock::now();
+		if (timeout < 0ns || timeout >= std::chrono::steady_clock::time_point::max() - now) return std::chrono::steady_clock::time_point::max();
+		return now + timeout;
+	}
+
+	// Park on a notifier until it is signalled, at most until the deadline. Returns ready() once the deadline has passed, true otherwise.
+	template<typename Predicate>
+	static bool parkUntil(Notifier &notifier, const Predicate &ready, std::chrono::steady_clock::time_point deadline) noexcept {
+		if (deadline == std::chrono::steady_clock::time_point::max()) notifier.waitUntil(ready, -1ns);
+		else {
+			const auto remaining = deadline - std::chrono::steady_clock::now();
+			if (remaining <= 0ns) return ready();
+			notifier.waitUntil(ready, remaining);
+		}
+		return true;
+	}
+
+	// Wait until all log output submitted before the call is completed, including the output of sinks with their own writer thread.
+	// Returns false if the deadline passes first.
+	static bool awaitOutput(std::chrono::steady_clock::time_point deadline) noexcept {
+		const size_t target = submittedTasks.load(std::memory_order_acquire);
+		const auto reached = [target] { return completedTasks.load(std::memory_order_acquire) >= target; };
+		while (!reached()) {
+			flushRequested.store(true, std::memory_order_relaxed);
+			queueNotifier.notify();
+			if (!parkUntil(completionNotifier, reached, deadline)) return false;
+		}
+
+		// Every record submitted before the call has now been passed on to the writer threads.
+		for (const SinkSlot &slot : *sinks.load()) {
+			if (!slot.writer) continue;
+			SinkWriter &writer = *slot.writer;
+			const size_t accepted = writer.accepted.load(std::memory_order_acquire);
+			const auto written = [&writer, accepted] { return writer.completed.load(std::memory_order_acquire) >= accepted; };
+			while (!written()) {
+				if (!parkUntil(writer.completionNotifier, written, deadline)) return false;
+			}
+		}
+		return true;
+	}
 
 	// Normalize logger name to avoid unexpected illegal characters in output.
 	static std::wstring legalizeLoggerName(const std::wstring &name) {
@@ -635,31 +5114,208 @@ private:
 		return (lastPos == std::wstring::npos) ? name : name.substr(lastPos + 1);
 	}
 
+	// Whether a log call argument is a field created with kv().
+	template<typename T>
+	struct IsField : std::false_type {};
+
+	template<typename Key, typename Value>
+	struct IsField<KeyValue<Key, Value>> : std::true_type {};
+
 	// Submit a log output task to the logging thread.
 	template<typename MessageType, typename... Args>
 	void log(const MessageType &message, const LogStyle &style, const Args &...args) const {
-		// Format message using formatMessage helper function.
-		const std::wstring formatted = StringConverter::formatMessage(message, args...);
+		submit<false>(0, message, style, args...);
+	}
+
+	// Log a message of one of the *Every() functions if its call site is due.
+	template<typename MessageType, typename... Args>
+	void submitEvery(const LogStyle &style, Every every, const MessageType &message, const Args &...args) const {
+		if (isEnabled(style.severity) && Sampler::every(every.site, every.interval)) submit<true>(static_cast<double>(std::max<size_t>(every.interval, 1)), message, style, args...);
+	}
+
+	// Log a message of one of the *Sampled() functions with the given probability.
+	template<typename MessageType, typename... Args>
+	void submitSampled(const LogStyle &style, double probability, const MessageType &message, const Args &...args) const {
+		if (isEnabled(style.severity) && Sampler::chance(probability)) submit<true>(1 / std::min(probability, 1.0), message, style, args...);
+	}
+
+	// Submit a log output task to the logging thread, marking sampled messages with the number of calls they stand for.
+	// Fields created with kv() are split off the format arguments.
+	template<bool Sampled, typename MessageType, typename... Args>
+	void submit(double sampleRate, const MessageType &message, const LogStyle &style, const Args &...args) const {
+		constexpr size_t fieldCount = (size_t{0} + ... + size_t{IsField<Args>::value});
+		if constexpr (fieldCount != 0)
+			submitFields<Sampled>(sampleRate, message, style, std::make_index_sequence<sizeof...(Args) - fieldCount>(), std::make_index_sequence<fieldCount>(), std::tie(args...));
+		else submitRecord<Sampled>(sampleRate, std::tuple<>(), message, style, args...);
+	}
+
+	// Submit a log call whose last arguments are fields.
+	template<bool Sampled, typename MessageType, size_t... Arguments, size_t... Fields, typename... Args>
+	void submitFields(double sampleRate, const MessageType &message, const LogStyle &style, std::index_sequence<Arguments...>, std::index_sequence<Fields...>,
+			const std::tuple<const Args &...> &args) const {
+		static_assert((IsField<std::tuple_element_t<sizeof...(Arguments) + Fields, std::tuple<Args...>>>::value && ...), "kv() fields must follow the format arguments");
+		submitRecord<Sampled>(sampleRate, std::tie(std::get<sizeof...(Arguments) + Fields>(args)...), message, style, std::get<Arguments>(args)...);
+	}
+
+	// Submit a log output task with the format arguments and the fields of a log call.
+	template<bool Sampled, typename Fields, typename MessageType, typename... Args>
+	void submitRecord([[maybe_unused]] double sampleRate, [[maybe_unused]] const Fields &fields, const MessageType &message, const LogStyle &style, const Args &...args) const {
+#ifndef KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER
+		// Record the time of the call, not the time the logging thread gets to it.
+		const std::int64_t timestamp = TimeUtils::now();
+
+		// The flight recorder keeps every call, including those below the level of the logger.
+		FlightRecorder::record(style, entry, timestamp, message, args...);
+		if (!isEnabled(style.severity)) return;
+#else
+		// Filter before doing any work for the message.
+		if (!isEnabled(style.severity)) return;
+
+		// Record the time of the call, not the time the logging thread gets to it.
+		const std::int64_t timestamp = TimeUtils::now();
+#endif
+
+		// Discard calls of call sites over the rate limit before any work for the message.
+		if constexpr (StringConverter::isLiteral<MessageType>) {
+			if (!RateLimiter::allow(style, entry, message, timestamp)) return;
+		}
+
+#ifdef KLY_LOGGER_OPTION_DEFERRED_FORMATTING
+		// Only copy the message format and arguments, the logging thread formats them.
+		using Deferred = DeferredMessage<decltype(StringConverter::captureMessage(message)), decltype(StringConverter::captureArgument(args))...>;
+		Deferred capture{StringConverter::captureMessage(message), {StringConverter::captureArgument(args)...}};
+
+		// Push log task to queue.
+		if constexpr (Sampled) enqueue(LogTask{&style, entry, timestamp, attachFields(SampledMessage<Deferred>{std::move(capture), sampleRate}, fields)});
+		else enqueue(LogTask{&style, entry, timestamp, attachFields(std::move(capture), fields)});
+#else
+		// Format the message on this thread and push log task to queue.
+		enqueue(LogTask{&style, entry, timestamp, formatOnCaller([&](OutputString &text) {
+			if constexpr (Sampled) appendSampleMarker(text, sampleRate);
+			StringConverter::formatMessageTo(text, message, args...);
+		}, fields)});
+#endif
+	}
+
+	// Marks a reusable buffer of the calling thread as in use until the end of the scope, also when a formatter throws.
+	struct BufferClaim {
+		bool &busy;
+
+		explicit BufferClaim(bool &busy) noexcept : busy(busy) { busy = true; }
+		~BufferClaim() { busy = false; }
+	};
+
+	// Wrap the capture of a log call in a LogMessage, together with its fields if it has any.
+	template<typename Capture, typename Fields>
+	static LogMessage attachFields(Capture &&capture, const Fields &fields) {
+		if constexpr (std::tuple_size_v<Fields> == 0) return LogMessage(std::move(capture));
+		else return LogMessage(FieldMessage<std::decay_t<Capture>>{std::move(capture), encodeFields(fields)});
+	}
+
+	// Encode fields into the reusable buffer of the calling thread and copy them into a MessagePool block.
+	template<typename Fields>
+	static PooledFields encodeFields(const Fields &fields) {
+		const auto encode = [&fields](std::string &out) { std::apply([&out](const auto &...field) { (FieldCodec::put(out, field), ...); }, fields); };
+
+		// Values whose formatters log themselves get a buffer of their own.
+		if (fieldBufferBusy) {
+			std::string out;
+			encode(out);
+			return PooledFields(out);
+		}
+		{
+			const BufferClaim claim(fieldBufferBusy);
+			fieldBuffer.clear();
+			encode(fieldBuffer);
+		}
+		PooledFields encoded(fieldBuffer);
+		if (fieldBuffer.capacity() > 64 * 1024) std::string().swap(fieldBuffer);
+		return encoded;
+	}
+
+	// Format a message into the reusable buffer of the calling thread and copy the text into a LogMessage,
+	// inline if it is short and into a MessagePool block otherwise, so no memory is allocated once both have warmed up.
+	template<typename Format, typename Fields = std::tuple<>>
+	static LogMessage formatOnCaller(const Format &format, const Fields &fields = {}) {
+		const auto store = [&fields](OutputView text) {
+			return text.length() <= InlineText::CAPACITY ? attachFields(InlineText(text), fields) : attachFields(PooledText(text), fields);
+		};
+
+		// Formatters that log themselves get a buffer of their own.
+		if (formatBufferBusy) {
+			OutputString text;
+			format(text);
+			return store(text);
+		}
+		{
+			const BufferClaim claim(formatBufferBusy);
+			formatBuffer.clear();
+			format(formatBuffer);
+		}
+		LogMessage message = store(formatBuffer);
+		// Do not keep the memory of an unusually long message.
+		if (formatBuffer.capacity() > 64 * 1024) OutputString().swap(formatBuffer);
+		return message;
+	}
 
-		// Push formatted log task to queue.
-		LockManager::execute([&style, &formatted, this] { logQueue.push({style, name, formatted}); });
+	// Push a log task to the queue, applying the overflow policy when it is full.
+	static void enqueue(LogTask &&task) {
+		// The logging thread is stopped or stopping, nothing would write the record.
+		if (stopRequested.load(std::memory_order_relaxed)) {
+			droppedRecords.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		// Count the task before it can be evicted, so completions never run ahead of the tasks wait() waits for.
+		submittedTasks.fetch_add(1);
+		// Check again after counting: the logging thread only exits once every counted task is done, so a task
+		// is either pushed while it still runs or dropped here.
+		if (stopRequested.load()) {
+			droppedRecords.fetch_add(1, std::memory_order_relaxed);
+			completedTasks.fetch_add(1, std::memory_order_release);
+			completionNotifier.notify();
+			return;
+		}
+		while (!logQueue.tryPush(std::move(task))) {
+			const OverflowPolicy policy = overflowPolicy.load(std::memory_order_relaxed);
+			if (policy == OverflowPolicy::OverwriteOldest) {
+				// Evict the oldest task, the logging thread may race us to it, either way a slot frees up.
+				if (logQueue.tryPop()) {
+					droppedRecords.fetch_add(1, std::memory_order_relaxed);
+					completedTasks.fetch_add(1, std::memory_order_release);
+					completionNotifier.notify();
+				}
+			} else if (policy == OverflowPolicy::DropNewest || isLoggingThread) {
+				droppedRecords.fetch_add(1, std::memory_order_relaxed);
+				completedTasks.fetch_add(1, std::memory_order_release);
+				completionNotifier.notify();
+				return;
+			} else spaceNotifier.waitUntil([] { return !logQueue.full(); }, -1ns);
+		}
+		enqueuedTasks.fetch_add(1, std::memory_order_release);
+		queueNotifier.notify();
 	}
 
 public:
 	// Construct a logger with no name.
-	explicit KlyLogger() noexcept : as_wstring(L"KlyLogger{name=<empty>}"), as_string("KlyLogger{name=<empty>}") {}
+	explicit KlyLogger() noexcept : as_wstring(L"KlyLogger{name=<empty>}"), as_string("KlyLogger{name=<empty>}"), entry(internLoggerName(name)) {}
 
 	// Construct a logger with a std::wstring name.
 	explicit KlyLogger(const std::wstring &name) noexcept :
 		name(legalizeLoggerName(name)),
 		as_wstring(L"KlyLogger{name=" + (this->name.empty() ? L"<empty>" : this->name) + L'}'),
-		as_string(StringConverter::toString(as_wstring)) {}
+		as_string(StringConverter::toString(as_wstring)),
+		entry(internLoggerName(this->name)) {}
 
 	// Construct a logger with a std::string name.
 	explicit KlyLogger(const std::string &name) noexcept :
 		name(legalizeLoggerName(StringConverter::toWString(name))),
 		as_wstring(L"KlyLogger{name=" + (name.empty() ? L"<empty>" : this->name) + L'}'),
-		as_string(StringConverter::toString(as_wstring)) {}
+		as_string(StringConverter::toString(as_wstring)),
+		entry(internLoggerName(this->name)) {}
+
+	// Copy a logger, including its current level threshold.
+	KlyLogger(const KlyLogger &other) noexcept :
+		name(other.name), as_wstring(other.as_wstring), as_string(other.as_string), entry(other.entry), threshold(other.threshold.load(std::memory_order_relaxed)) {}
 
 	// Retrieve logger name as std::string.
 	[[nodiscard]] const std::string &string() const noexcept { return as_string; }
@@ -667,84 +5323,677 @@ public:
 	// Retrieve logger name as std::wstring.
 	[[nodiscard]] const std::wstring &wstring() const noexcept { return as_wstring; }
 
+	// Set the lowest level this logger outputs (default: LogLevel::Trace), safe to call while other threads log.
+	void setLevel(LogLevel level) noexcept { threshold.store(level, std::memory_order_relaxed); }
+
+	// Retrieve the lowest level this logger outputs.
+	[[nodiscard]] LogLevel getLevel() const noexcept { return threshold.load(std::memory_order_relaxed); }
+
+	// Check whether messages of the given level would be output by this logger.
+	[[nodiscard]] bool isEnabled(LogLevel level) const noexcept {
+		return isCompiledIn(level) && level >= threshold.load(std::memory_order_relaxed);
+	}
+
+	// Log a TRACE-level message.
+	template<typename MessageType, typename... Args>
+	void trace(MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Trace)) log(StringConverter::messageOf(std::forward<MessageType>(message)), TRACE_STYLE, args...);
+	}
+
+	// Log a DEBUG-level message.
+	template<typename MessageType, typename... Args>
+	void debug(MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Debug)) log(StringConverter::messageOf(std::forward<MessageType>(message)), DEBUG_STYLE, args...);
+	}
+
 	// Log an INFO-level message.
 	template<typename MessageType, typename... Args>
-	void info(const MessageType &message, const Args &...args) const noexcept {
-		log(message, INFO_STYLE, args...);
+	void info(MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Info)) log(StringConverter::messageOf(std::forward<MessageType>(message)), INFO_STYLE, args...);
 	}
 
 	// Log an WARN-level message.
 	template<typename MessageType, typename... Args>
-	void warn(const MessageType &message, const Args &...args) const noexcept {
-		log(message, WARN_STYLE, args...);
+	void warn(MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Warn)) log(StringConverter::messageOf(std::forward<MessageType>(message)), WARN_STYLE, args...);
 	}
 
 	// Log an ERROR-level message.
 	template<typename MessageType, typename... Args>
-	void error(const MessageType &message, const Args &...args) const noexcept {
-		log(message, ERROR_STYLE, args...);
+	void error(MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Error)) log(StringConverter::messageOf(std::forward<MessageType>(message)), ERROR_STYLE, args...);
+	}
+
+	// Log an FATAL-level message, write the flight recorder to logs/crash-*.log and wait until the message is output.
+	template<typename MessageType, typename... Args>
+	void fatal(MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Fatal)) {
+			log(StringConverter::messageOf(std::forward<MessageType>(message)), FATAL_STYLE, args...);
+#ifndef KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER
+			FlightRecorder::dump("fatal()");
+#endif
+			if (!isLoggingThread) wait();
+		}
+	}
+
+	// Log a message at the level in the name on the first call from this call site and then on every interval-th call
+	// (counted per thread), prefixed with "[sample 1/interval] ". Skipped calls return before any work for the message.
+	template<typename MessageType, typename... Args>
+	void traceEvery(Every every, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Trace)) submitEvery(TRACE_STYLE, every, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void debugEvery(Every every, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Debug)) submitEvery(DEBUG_STYLE, every, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void infoEvery(Every every, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Info)) submitEvery(INFO_STYLE, every, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void warnEvery(Every every, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Warn)) submitEvery(WARN_STYLE, every, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void errorEvery(Every every, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Error)) submitEvery(ERROR_STYLE, every, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	// Log a message at the level in the name with the given probability, prefixed with "[sample 1/N] " where N is 1 / probability.
+	// Skipped calls return before any work for the message.
+	template<typename MessageType, typename... Args>
+	void traceSampled(double probability, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Trace)) submitSampled(TRACE_STYLE, probability, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void debugSampled(double probability, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Debug)) submitSampled(DEBUG_STYLE, probability, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
 	}
 
-	// Log an FATAL-level message.
 	template<typename MessageType, typename... Args>
-	void fatal(const MessageType &message, const Args &...args) const noexcept {
-		log(message, FATAL_STYLE, args...);
+	void infoSampled(double probability, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Info)) submitSampled(INFO_STYLE, probability, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void warnSampled(double probability, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Warn)) submitSampled(WARN_STYLE, probability, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
+	}
+
+	template<typename MessageType, typename... Args>
+	void errorSampled(double probability, MessageType &&message, const Args &...args) const noexcept {
+		if constexpr (isCompiledIn(LogLevel::Error)) submitSampled(ERROR_STYLE, probability, StringConverter::messageOf(std::forward<MessageType>(message)), args...);
 	}
 
 	// Check if all pending log tasks have been processed.
-	static bool finishedTasks() noexcept { return logQueue.empty(); }
+	static bool finishedTasks() noexcept {
+		return completedTasks.load(std::memory_order_acquire) >= submittedTasks.load(std::memory_order_acquire);
+	}
+
+	// Number of log records discarded so far because the log queue was full.
+	static size_t droppedRecordCount() noexcept { return droppedRecords.load(std::memory_order_relaxed); }
+
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+	// Whether this process writes the console and the log file for every process sharing its logs directory (see KLY_LOGGER_OPTION_SHARED_RING).
+	// The first process to start becomes the writer, another one takes over when it exits.
+	[[nodiscard]] static bool isSharedRingWriter() noexcept { return SharedRing::isWriter(); }
+#endif
+
+	// Snapshot of the counters the logger keeps about itself (see Stats), cheap enough to poll.
+	// The counters are read one by one while other threads log, so they may be a few records apart.
+	[[nodiscard]] static Stats stats() {
+		const auto snapshot = [](const LatencyCounter &counter) {
+			LatencyHistogram histogram;
+			for (size_t i = 0; i < LATENCY_BUCKETS; i++) histogram.buckets[i] = counter.buckets[i].load(std::memory_order_relaxed);
+			return histogram;
+		};
+
+		Stats result{};
+		result.enqueued = enqueuedTasks.load(std::memory_order_relaxed);
+		result.written = writtenRecords.load(std::memory_order_relaxed);
+		result.dropped = droppedRecords.load(std::memory_order_relaxed);
+		result.queueDepth = logQueue.size();
+		result.queueHighWater = queueHighWater.load(std::memory_order_relaxed);
+		result.queueCapacity = KLY_LOGGER_OPTION_QUEUE_CAPACITY;
+		result.latency = snapshot(writeLatency);
+		for (const SinkSlot &slot : *sinks.load()) {
+			// The sink calling setAfterLog() functions is internal, its time is reported as callbackTime.
+			if (dynamic_cast<AfterLogSink *>(slot.sink.get())) continue;
+			const Sink &sink = *slot.sink;
+			result.sinks.push_back(SinkStats{slot.sink, sink.writtenRecords.load(std::memory_order_relaxed), sink.writtenBytes.load(std::memory_order_relaxed),
+					sink.droppedRecordCount(), slot.writer ? slot.writer->queue.size() : 0, slot.writer ? snapshot(sink.latency) : result.latency});
+		}
+		result.rotations = rotationCount.load(std::memory_order_relaxed);
+		result.rotationTime = std::chrono::nanoseconds(rotationNanoseconds.load(std::memory_order_relaxed));
+		result.callbackTime = std::chrono::nanoseconds(callbackNanoseconds.load(std::memory_order_relaxed));
+		result.priorityBoosts = priorityBoosts.load(std::memory_order_relaxed);
+		return result;
+	}
+
+	// Output a line with the statistics of stats() at this interval, logged as INFO by a logger named "KlyLogger"
+	// with key=value pairs, e.g. "Stats: enqueued=1200 written=1200 dropped=0 queue_depth=0 ...". Zero turns it off (default).
+	static void setStatsInterval(std::chrono::milliseconds interval) noexcept {
+		statsInterval.store(interval.count(), std::memory_order_relaxed);
+		queueNotifier.notify();
+	}
+
+	// Select what happens when the log queue is full (default: OverflowPolicy::Block).
+	// Calls made from the logging thread itself (e.g. inside callbacks) never block and drop instead.
+	static void setOverflowPolicy(OverflowPolicy policy) noexcept {
+		overflowPolicy.store(policy, std::memory_order_relaxed);
+	}
+
+	// Block the current thread until all log output submitted before the call is completed,
+	// including the output of sinks with their own writer thread.
+	static void wait() noexcept { awaitOutput(std::chrono::steady_clock::time_point::max()); }
+
+	// Block the current thread until all log output submitted before the call is written, for at most the timeout
+	// (negative waits as long as it takes). With sync, the sinks also store it on disk (fsync of the log file) before returning.
+	// Returns whether everything was written in time, always false when called from the logging thread (e.g. in a sink).
+	static bool flush(std::chrono::nanoseconds timeout = -1ns, bool sync = false) noexcept {
+		if (isLoggingThread) return false;
+		const auto deadline = deadlineAfter(timeout);
+		if (!awaitOutput(deadline)) return false;
+		if (!sync) return true;
+
+		// Nothing runs the sinks after shutdown(), so they can be synced right here.
+		if (loggingThreadExited.load(std::memory_order_acquire)) {
+			for (const SinkSlot &slot : *sinks.load()) {
+				if (!slot.writer || slot.writer->exited.load(std::memory_order_acquire)) syncSink(*slot.sink);
+			}
+			return true;
+		}
+
+		const size_t ticket = syncRequests.fetch_add(1) + 1;
+		queueNotifier.notify();
+		const auto synced = [ticket] { return completedSyncs.load(std::memory_order_acquire) >= ticket || loggingThreadExited.load(std::memory_order_acquire); };
+		while (!synced()) {
+			if (!parkUntil(completionNotifier, synced, deadline)) return false;
+		}
+		for (const SinkSlot &slot : *sinks.load()) {
+			if (!slot.writer) continue;
+			SinkWriter &writer = *slot.writer;
+			const size_t writerTicket = writer.syncRequests.fetch_add(1) + 1;
+			writer.queueNotifier.notify();
+			const auto writerSynced = [&writer, writerTicket] {
+				return writer.syncs.load(std::memory_order_acquire) >= writerTicket || writer.exited.load(std::memory_order_acquire);
+			};
+			while (!writerSynced()) {
+				if (!parkUntil(writer.completionNotifier, writerSynced, deadline)) return false;
+			}
+		}
+		return true;
+	}
+
+	// Write all log output submitted so far, then stop the logging thread and the writer threads of sinks and wait for them
+	// to exit, for at most the timeout (negative waits as long as it takes). Log calls made afterwards are discarded.
+	// Returns whether the threads exited in time. Runs on normal process exit with the timeout of setExitTimeout().
+	static bool shutdown(std::chrono::nanoseconds timeout = -1ns) noexcept {
+		if (isLoggingThread) return false;
+#ifndef _WIN32
+		// Without threads of its own there is nothing to wait for, log calls are discarded from now on.
+		if (loggingThreadProcess != getpid()) {
+			stopRequested.store(true);
+			abandonThreads();
+			return true;
+		}
+#endif
+		const auto deadline = deadlineAfter(timeout);
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+		SharedRing::stop();
+#endif
+		stopRequested.store(true);
+		queueNotifier.notify();
+		const auto exited = [] { return loggingThreadExited.load(std::memory_order_acquire); };
+		while (!exited()) {
+			if (!parkUntil(completionNotifier, exited, deadline)) return false;
+		}
+		if (!loggingThreadReleased.test_and_set()) loggingThread.join();
+
+		// Records of calls that raced with the stop were not written, count them as dropped so wait() does not block on them.
+		while (logQueue.tryPop()) {
+			droppedRecords.fetch_add(1, std::memory_order_relaxed);
+			completedTasks.fetch_add(1, std::memory_order_release);
+		}
+		completionNotifier.notify();
+
+		// The logging thread has passed on every record, the writer threads exit once they have written them.
+		for (const SinkSlot &slot : *sinks.load()) {
+			if (!slot.writer) continue;
+			SinkWriter &writer = *slot.writer;
+			writer.stopping.store(true);
+			writer.queueNotifier.notify();
+			const auto writerExited = [&writer] { return writer.exited.load(std::memory_order_acquire); };
+			while (!writerExited()) {
+				if (!parkUntil(writer.completionNotifier, writerExited, deadline)) return false;
+			}
+		}
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+		// The logging thread no longer rotates, so the maintenance worker runs if it was started before.
+		if (maintenanceStarted.load()) {
+			maintenanceStopping.store(true);
+			maintenanceNotifier.notify();
+			const auto maintenanceDone = [] { return maintenanceExited.load(std::memory_order_acquire); };
+			while (!maintenanceDone()) {
+				if (!parkUntil(maintenanceNotifier, maintenanceDone, deadline)) return false;
+			}
+			if (maintenanceThread.joinable()) maintenanceThread.join();
+		}
+#endif
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+		SharedRing::release();
+#endif
+		return true;
+	}
+
+	// Set the longest time normal process exit waits for queued log output to be written (default: 5 seconds,
+	// negative waits as long as it takes). Output still queued after it is lost.
+	static void setExitTimeout(std::chrono::milliseconds timeout) noexcept {
+		exitTimeout.store(timeout.count(), std::memory_order_relaxed);
+	}
+
+	// Add a sink to the record stream, see SinkOptions for running it on its own writer thread.
+	// The built-in console and file sinks are added by default.
+	static void addSink(const std::shared_ptr<Sink> &sink, const SinkOptions &options) {
+		SinkSlot slot{sink, nullptr};
+		if (options.ownThread) {
+			slot.writer = std::make_shared<SinkWriter>(options.overflowPolicy);
+			std::thread(runSinkWriter, sink, slot.writer).detach();
+		}
+		updateSinks([&slot](SinkList &list) { list.push_back(slot); });
+	}
+
+	// Add a sink to the record stream, written by the logging thread.
+	static void addSink(const std::shared_ptr<Sink> &sink) { addSink(sink, SinkOptions()); }
+
+	// Remove a sink from the record stream, a sink with its own thread still writes the records queued for it.
+	// Do not add a built-in sink again until wait() has returned after removing it.
+	static void removeSink(const std::shared_ptr<Sink> &sink) {
+		std::vector<std::shared_ptr<SinkWriter>> removed;
+		updateSinks([&](SinkList &list) {
+			removed.clear();
+			for (const SinkSlot &slot : list) {
+				if (slot.sink == sink && slot.writer) removed.push_back(slot.writer);
+			}
+			std::erase_if(list, [&sink](const SinkSlot &slot) { return slot.sink == sink; });
+		});
+		for (const std::shared_ptr<SinkWriter> &writer : removed) {
+			writer->stopping.store(true);
+			writer->queueNotifier.notify();
+		}
+	}
+
+	// The built-in sink writing colored output to the console, e.g. to limit it with setLevel().
+	[[nodiscard]] static const std::shared_ptr<Sink> &consoleSink() noexcept { return builtinConsoleSink; }
+
+	// The built-in sink writing to logs/latest.log.
+	[[nodiscard]] static const std::shared_ptr<Sink> &fileSink() noexcept { return builtinFileSink; }
+
+	// Select the console output when stderr is not a terminal, e.g. under Docker, Kubernetes or systemd (default: StreamFormat::None).
+	// Records are written without color codes in large blocks according to the flush policy, as plain lines or as JSON lines.
+	static void setStreamFormat(StreamFormat format) noexcept {
+		streamFormat.store(format, std::memory_order_relaxed);
+	}
+
+	// Select how logs/latest.log renders records and the fields attached with kv() (default: FieldFormat::Logfmt).
+	// Logfmt appends key=value pairs to the text line, JsonLines writes every record as a JSON object with the fields as members.
+	static void setFieldFormat(FieldFormat format) noexcept {
+		fieldFormat.store(format, std::memory_order_relaxed);
+	}
+
+	// Select the resolution of the time shown in the log header (default: TimePrecision::Seconds).
+	static void setTimePrecision(TimePrecision precision) noexcept {
+		timePrecision.store(precision, std::memory_order_relaxed);
+	}
+
+	// Configure when the logging thread writes buffered output (see FlushPolicy).
+	static void setFlushPolicy(const FlushPolicy &policy) noexcept {
+		flushMaxBytes.store(policy.maxBufferedBytes, std::memory_order_relaxed);
+		flushMaxDelay.store(policy.maxDelay.count(), std::memory_order_relaxed);
+		flushOnError.store(policy.immediateOnError, std::memory_order_relaxed);
+	}
+
+	// Configure the per-call-site rate limit and the collapsing of repeated records (see RateLimitPolicy).
+	static void setRateLimitPolicy(const RateLimitPolicy &policy) noexcept {
+		RateLimiter::configure(policy.maxRecordsPerSecond, policy.burst);
+		collapseRepeats.store(policy.collapseRepeats, std::memory_order_relaxed);
+	}
+
+	// Configure the CPUs and priority of the logging thread and the writer threads of sinks (see SchedulingPolicy),
+	// applied by each of them with its next log record.
+	static void setSchedulingPolicy(const SchedulingPolicy &policy) {
+		schedulingPolicy.store(std::make_shared<const SchedulingPolicy>(policy));
+		schedulingVersion.fetch_add(1, std::memory_order_release);
+	}
 
-	// Block the current thread until all log output is completed.
-	static void wait() noexcept {
-		while (!finishedTasks()) pauseBriefly();
+	// Configure log file rotation and retention (see RotationPolicy), applied from the next log record on.
+	static void setRotationPolicy(const RotationPolicy &policy) noexcept {
+		rotateMaxBytes.store(policy.maxFileBytes, std::memory_order_relaxed);
+		retainMaxFiles.store(policy.maxBackupFiles, std::memory_order_relaxed);
+		retainMaxBytes.store(policy.maxBackupBytes, std::memory_order_relaxed);
+		rotationPolicyChanged.store(true);
 	}
 
-	// Register a callback function to execute after each log output.
+	// Register a callback function to execute after each log output (kept for compatibility, see addSink() and CallbackSink).
 	// The callback receives two parameters:
 	//   1. The original log message (may include formatting codes).
 	//   2. The plain text version of the message (with formatting removed).
 	static void setAfterLog(const std::function<void(const std::wstring &, const std::wstring &)> &func) noexcept {
 		afterLog = func;
+		afterLogFields = nullptr;
+	}
+
+	// Register a callback function to execute after each log output, also receiving the fields attached with kv().
+	// Replaces a callback registered with the two-parameter overload; every line of a record receives the same fields.
+	static void setAfterLog(const std::function<void(const std::wstring &, const std::wstring &, const std::vector<LogField> &)> &func) noexcept {
+		afterLogFields = func;
+		afterLog = nullptr;
 	}
 
 	// Register a callback function to execute before each log output.
+	// The console sink calls it before every line it outputs, on the thread that writes the console, so it can e.g. clear
+	// a progress line. Records the console sink does not take call it once, on the logging thread before the first sink.
 	static void setBeforeLog(const std::function<void()> &func) noexcept {
 		beforeLog = func;
 	}
 
 private:
-	// Initialize a background thread to handle log queue processing and callbacks,
-	// ensuring it stays alive until program exit.
-	static inline std::shared_ptr<void> waiter = [] {
-		auto threadFunc = [] [[noreturn]] {
-		// Set the current thread to the lowest priority.
-#ifdef _WIN32
-			const HANDLE hThread = GetCurrentThread();
-			SetThreadPriority(hThread, THREAD_PRIORITY_IDLE);
+	// Body of the logging thread: pass the queued records to the sinks, flush and sync as asked, and exit once shutdown() stops it.
+	static void runLoggingThread() {
+		setLowestThreadPriority();
+		isLoggingThread = true;
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+		// Only the writer of the shared ring opens the log file, with its first record.
+		if (SharedRing::isWriter()) FileLogger::initialize();
 #else
-			setpriority(PRIO_PROCESS, gettid(), 19);
+		FileLogger::initialize();
+#endif
+		size_t spinLimit = KLY_LOGGER_OPTION_SPIN_LIMIT;
+		std::shared_ptr<const SinkList> activeSinks = sinks.load();
+		size_t activeVersion = 0;
+		// Scheduling policy in effect, its version and whether the priority is raised because of a backlog.
+		// A boost that failed is not tried again until the queue has been drained or the policy changes.
+		std::shared_ptr<const SchedulingPolicy> scheduling;
+		size_t schedulingApplied = 0;
+		bool boosted = false, boostFailed = false;
+		while (true) {
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+			// Leave the state a forked child takes over alone until the fork is done.
+			if (forkRequested.load()) pauseForFork();
 #endif
+			// Drain every pending task into the sinks.
+			while (std::optional<LogTask> task = logQueue.tryPop()) {
+				spaceNotifier.notify();
+				const size_t depth = logQueue.size() + 1;
+				if (depth > queueHighWater.load(std::memory_order_relaxed)) queueHighWater.store(depth, std::memory_order_relaxed);
+				if (updateScheduling(scheduling, schedulingApplied)) boosted = boostFailed = false;
+				// Switch to a changed sink list, after writing what the previous sinks buffered.
+				if (const size_t version = sinksVersion.load(std::memory_order_acquire); version != activeVersion) {
+					if (bufferedTasks) flushOutput(*activeSinks);
+					activeSinks = sinks.load();
+					activeVersion = version;
+				}
 
-			FileLogger::initialize();
-			while (true) {
-				while (logQueue.empty()) pauseBriefly();
+				dispatch(*activeSinks, *task);
+				const std::int64_t lag = TimeUtils::now() - task->timestamp;
+				writeLatency.add(lag);
+				increase(writtenRecords, 1);
 
-				LockManager::execute([] {
-					auto &[style, name, message] = logQueue.front();
-#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
-					FileLogger::updateIfNeeded();
+				// Raise the priority while a backlog builds up, it is lowered again once the queue has been drained.
+				if (scheduling && !boosted && !boostFailed && ((scheduling->boostQueueDepth && depth >= scheduling->boostQueueDepth) ||
+						(scheduling->boostLag > 0ms && lag >= std::chrono::nanoseconds(scheduling->boostLag).count()))) {
+					if (applyPriority(*scheduling, true)) {
+						boosted = true;
+						increase(priorityBoosts, 1);
+					} else {
+						// Undo a partly applied boost, e.g. a changed scheduling class without the raised nice value.
+						applyPriority(*scheduling, false);
+						boostFailed = true;
+					}
+				}
+				if (!bufferedTasks++) bufferedSince = std::chrono::steady_clock::now();
+
+				const bool isError = task->style->severity >= LogLevel::Error;
+				if ((isError && flushOnError.load(std::memory_order_relaxed)) || bufferedBytes(*activeSinks) >= flushMaxBytes.load(std::memory_order_relaxed))
+					flushOutput(*activeSinks);
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+				if (forkRequested.load(std::memory_order_relaxed)) break;
+#endif
+			}
+
+			// Write the batch once the queue is drained, unless the flush policy allows buffering it longer.
+			std::chrono::nanoseconds timeout(-1);
+			const bool requested = flushRequested.exchange(false, std::memory_order_relaxed);
+			if (bufferedTasks) {
+				const std::chrono::milliseconds maxDelay(flushMaxDelay.load(std::memory_order_relaxed));
+				const auto elapsed = std::chrono::steady_clock::now() - bufferedSince;
+				if (requested || maxDelay <= 0ms || elapsed >= maxDelay) flushOutput(*activeSinks);
+				else timeout = maxDelay - elapsed;
+			}
+
+			// Store the output on disk when flush() asked for it.
+			if (const size_t requests = syncRequests.load(std::memory_order_acquire); requests != completedSyncs.load(std::memory_order_relaxed)) {
+				if (bufferedTasks) flushOutput(*activeSinks);
+				syncOutput(*activeSinks);
+				completedSyncs.store(requests, std::memory_order_release);
+				completionNotifier.notify();
+			}
+
+			// Output the counts of suppressed records once they are due, and wake up for the next one.
+			// Calls that passed the check for a stop in enqueue() may still be pushing their task, wait for them too.
+			const bool stopping = stopRequested.load() && logQueue.empty() && completedTasks.load(std::memory_order_acquire) + bufferedTasks >= submittedTasks.load();
+			if (const std::chrono::nanoseconds due = reportSuppressed(*activeSinks, stopping); due >= 0ns)
+				timeout = timeout < 0ns ? due : std::min(timeout, due);
+			if (const std::chrono::nanoseconds due = reportStats(*activeSinks); due >= 0ns)
+				timeout = timeout < 0ns ? due : std::min(timeout, due);
+
+			// Exit once shutdown() asked for it and everything has been written.
+			if (stopping) {
+				if (bufferedTasks) flushOutput(*activeSinks);
+				loggingThreadExited.store(true, std::memory_order_release);
+				completionNotifier.notify();
+				return;
+			}
+
+			// Spin briefly while records keep arriving, the spin limit adapts to how often that pays off.
+			size_t spins = 0;
+			while (spins < spinLimit && logQueue.empty()) {
+				cpuRelax();
+				spins++;
+			}
+			if (!logQueue.empty()) {
+				spinLimit = std::min<size_t>(spinLimit * 2 + 1, KLY_LOGGER_OPTION_SPIN_LIMIT);
+				continue;
+			}
+			spinLimit /= 2;
+			if (boosted) applyPriority(*scheduling, boosted = false);
+			boostFailed = false;
+
+			// Sleep until new tasks arrive, wait() asks for a flush, flush() for a sync, shutdown() to stop, or buffered output is due.
+			queueNotifier.waitUntil([] {
+				return !logQueue.empty() || flushRequested.load(std::memory_order_relaxed) || stopRequested.load(std::memory_order_relaxed) ||
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+					forkRequested.load(std::memory_order_relaxed) ||
 #endif
-					MessageProcessor::processMessage(name, message, style);
+					syncRequests.load(std::memory_order_relaxed) != completedSyncs.load(std::memory_order_relaxed);
+			}, timeout);
+		}
+	}
 
-					logQueue.pop();
-				});
+	// Thread processing the log queue, joined by shutdown().
+	static inline std::thread loggingThread;
+
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+	// Wait in the logging thread while another thread forks, so the child copies its state between two records.
+	static void pauseForFork() noexcept {
+		// Forks that follow each other before this thread wakes up are acknowledged without resuming in between.
+		size_t acknowledged = 0;
+		while (forkRequested.load()) {
+			if (const size_t requests = forkRequests.load(); requests != acknowledged) {
+				forkAcknowledged.store(acknowledged = requests, std::memory_order_release);
+				completionNotifier.notify();
 			}
-		};
+			queueNotifier.waitUntil([&acknowledged] { return !forkRequested.load() || forkRequests.load() != acknowledged; }, -1ns);
+		}
+	}
+
+	// Before fork(): pause the logging thread and the shared ring at a point where the child can take their state over.
+	static void prepareFork() noexcept {
+		while (forkLock.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+		// The ring first, since moving its records into a full queue waits for the logging thread.
+		SharedRing::prepareFork();
+		if (!isLoggingThread) {
+			const size_t ticket = forkRequests.fetch_add(1) + 1;
+			forkRequested.store(true);
+			queueNotifier.notify();
+			const auto paused = [ticket] { return forkAcknowledged.load(std::memory_order_acquire) >= ticket || loggingThreadExited.load(std::memory_order_acquire); };
+			while (!paused()) completionNotifier.waitUntil(paused, -1ns);
+		}
+	}
+
+	// After fork() in the parent: let the logging thread and the shared ring go on.
+	static void resumeAfterFork() noexcept {
+		forkRequested.store(false);
+		queueNotifier.notify();
+		SharedRing::resumeAfterFork();
+		forkLock.clear(std::memory_order_release);
+	}
+
+	// After fork() in the child, which has none of the threads of its parent: start a logging thread and sink writer threads of its own.
+	// Records queued in the parent but not yet written are left to the parent. Objects the threads of the parent were using are
+	// abandoned rather than destroyed, since they may have been in the middle of a change.
+	static void restartAfterFork() noexcept {
+		SharedRing::restartAfterFork();
+		forkRequested.store(false, std::memory_order_relaxed);
+		forkLock.clear(std::memory_order_release);
+		if (stopRequested.load() || loggingThreadExited.load()) return;
+
+		new (&logQueue) RingBuffer<LogTask, KLY_LOGGER_OPTION_QUEUE_CAPACITY>();
+		submittedTasks.store(0);
+		completedTasks.store(0);
+		flushRequested.store(false);
+		completedSyncs.store(syncRequests.load());
+		lineBuffer.clear();
+		consoleBuffer.clear();
+		streamBuffer.clear();
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+		// The child opens its own latest.log once it becomes the writer of the ring.
+		fileBuffer.clear();
+		new (&logFile) LogFile();
+		logFileCreateDate = 0;
+		logFileSize = 0;
+		new (&maintenanceThread) std::thread();
+		maintenanceStarted.store(false);
+		maintenanceRequested.store(false);
+		maintenanceStopping.store(false);
+		maintenanceExited.store(false);
+#endif
+		try {
+			const std::shared_ptr<const SinkList> inherited = sinks.load();
+			auto list = std::make_shared<SinkList>(*inherited);
+			for (SinkSlot &slot : *list) {
+				if (slot.writer) slot.writer = std::make_shared<SinkWriter>(slot.writer->overflowPolicy);
+			}
+			// The writers of the parent stay referenced, their queues are not cleaned up.
+			new std::shared_ptr<const SinkList>(inherited);
+			sinks.store(list);
+			sinksVersion.fetch_add(1, std::memory_order_release);
+			for (const SinkSlot &slot : *list) {
+				if (slot.writer) std::thread(runSinkWriter, slot.sink, slot.writer).detach();
+			}
+			new (&loggingThread) std::thread(runLoggingThread);
+			loggingThreadProcess = getpid();
+		} catch (...) {
+			// Without a logging thread, log calls are discarded.
+			stopRequested.store(true);
+			loggingThreadExited.store(true);
+			new (&loggingThread) std::thread();
+		}
+	}
+#endif
+
+#ifndef _WIN32
+	// Let go of the thread handles inherited from the parent of a forked child, joining or destroying them is not safe.
+	static void abandonThreads() noexcept {
+		if (!loggingThreadReleased.test_and_set()) new (&loggingThread) std::thread();
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+		if (maintenanceThread.joinable()) new (&maintenanceThread) std::thread();
+#endif
+	}
+#endif
 
-		std::thread(threadFunc).detach();
+	// Start the logging thread and shut it down on normal process exit, before the state it uses is destroyed.
+	static inline std::shared_ptr<void> waiter = [] {
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+		SharedRing::attach();
+#endif
+		loggingThread = std::thread(runLoggingThread);
+#ifndef _WIN32
+		loggingThreadProcess = getpid();
+#endif
+#if defined(KLY_LOGGER_OPTION_SHARED_RING) && !defined(_WIN32)
+		// A child forked without exec joins the ring like a process of its own.
+		pthread_atfork(prepareFork, resumeAfterFork, restartAfterFork);
+#endif
 
-		return std::shared_ptr<void>(nullptr, [](void *) { wait(); });
+		return std::shared_ptr<void>(nullptr, [](void *) {
+			// Leave the logging thread and the maintenance worker running if they did not finish in time, the process ends anyway.
+			if (!shutdown(std::chrono::milliseconds(exitTimeout.load(std::memory_order_relaxed)))) {
+				if (!loggingThreadReleased.test_and_set()) loggingThread.detach();
+#ifndef KLY_LOGGER_OPTION_NO_LOG_FILE
+				if (maintenanceThread.joinable()) maintenanceThread.detach();
+#endif
+			}
+		});
 	}();
 };
 
+// Logging macros that skip argument evaluation when the level is disabled at compile time or at runtime.
+// Usage: KLY_LOGGER_DEBUG(logger, L"Loaded {} entries", expensiveCount());
+#define KLY_LOGGER_LOG_IF_ENABLED(logger, level, method, ...) \
+	do { \
+		if ((logger).isEnabled(KlyLogger::LogLevel::level)) (logger).method(__VA_ARGS__); \
+	} while (false)
+
+#if KLY_LOGGER_OPTION_MIN_LEVEL <= KLY_LOGGER_LEVEL_TRACE
+#define KLY_LOGGER_TRACE(logger, ...) KLY_LOGGER_LOG_IF_ENABLED(logger, Trace, trace, __VA_ARGS__)
+#else
+#define KLY_LOGGER_TRACE(logger, ...) ((void) 0)
+#endif
+
+#if KLY_LOGGER_OPTION_MIN_LEVEL <= KLY_LOGGER_LEVEL_DEBUG
+#define KLY_LOGGER_DEBUG(logger, ...) KLY_LOGGER_LOG_IF_ENABLED(logger, Debug, debug, __VA_ARGS__)
+#else
+#define KLY_LOGGER_DEBUG(logger, ...) ((void) 0)
+#endif
+
+#if KLY_LOGGER_OPTION_MIN_LEVEL <= KLY_LOGGER_LEVEL_INFO
+#define KLY_LOGGER_INFO(logger, ...) KLY_LOGGER_LOG_IF_ENABLED(logger, Info, info, __VA_ARGS__)
+#else
+#define KLY_LOGGER_INFO(logger, ...) ((void) 0)
+#endif
+
+#if KLY_LOGGER_OPTION_MIN_LEVEL <= KLY_LOGGER_LEVEL_WARN
+#define KLY_LOGGER_WARN(logger, ...) KLY_LOGGER_LOG_IF_ENABLED(logger, Warn, warn, __VA_ARGS__)
+#else
+#define KLY_LOGGER_WARN(logger, ...) ((void) 0)
+#endif
+
+#if KLY_LOGGER_OPTION_MIN_LEVEL <= KLY_LOGGER_LEVEL_ERROR
+#define KLY_LOGGER_ERROR(logger, ...) KLY_LOGGER_LOG_IF_ENABLED(logger, Error, error, __VA_ARGS__)
+#else
+#define KLY_LOGGER_ERROR(logger, ...) ((void) 0)
+#endif
+
+#if KLY_LOGGER_OPTION_MIN_LEVEL <= KLY_LOGGER_LEVEL_FATAL
+#define KLY_LOGGER_FATAL(logger, ...) KLY_LOGGER_LOG_IF_ENABLED(logger, Fatal, fatal, __VA_ARGS__)
+#else
+#define KLY_LOGGER_FATAL(logger, ...) ((void) 0)
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,401 @@
+// klylogger_bench: measure the hot paths of KlyLogger under the console and file setups it runs in.
+// Usage: klylogger_bench [--output null|tmpfs|pty|all] [--case latency|throughput|e2e|backlog|large|sizes|alloc|all] [--records N]
+// Every output runs in its own child process, since KlyLogger decides at startup whether stderr is a terminal:
+//   null   stderr is /dev/null and the log file is replaced by a sink formatting every record into /dev/null
+//   tmpfs  stderr is /dev/null and latest.log is written to tmpfs (the executable is copied to /dev/shm and run from there)
+//   pty    stderr is a pseudo terminal drained by the parent, so the colored console output is written in full
+// Results are printed to stdout as one line per metric. Exits with 1 if an output failed or a log call allocated. POSIX only.
+
+#include "KlyLogger.hpp"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <barrier>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+// Number of heap allocations made by the current thread, counted by the replaced operator new.
+thread_local size_t allocations = 0;
+
+void *operator new(std::size_t size) {
+	allocations++;
+	if (void *memory = std::malloc(size ? size : 1)) return memory;
+	throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+	allocations++;
+	const auto align = static_cast<std::size_t>(alignment);
+	if (void *memory = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align)) return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+
+namespace {
+
+constexpr const char *OUTPUTS[]{"null", "tmpfs", "pty"};
+constexpr const char *CASES[]{"latency", "throughput", "e2e", "backlog", "large", "sizes", "alloc"};
+
+const char *currentOutput = "";
+const char *currentCase = "";
+
+// Print one result line.
+template<typename... Args>
+void report(const char *metric, std::format_string<Args...> format, Args &&...args) {
+	std::printf("%-6s %-11s %-34s %s\n", currentOutput, currentCase, metric, std::format(format, std::forward<Args>(args)...).c_str());
+	std::fflush(stdout);
+}
+
+// Value at a fraction of the sorted samples.
+template<typename T>
+T percentile(const std::vector<T> &sorted, double fraction) {
+	if (sorted.empty()) return T();
+	return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * static_cast<double>(sorted.size())))];
+}
+
+// Resident memory of the process in KiB.
+long residentKiB() {
+	long pages = 0, resident = 0;
+	if (FILE *statm = std::fopen("/proc/self/statm", "r")) {
+		if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+		std::fclose(statm);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Current time in nanoseconds since the Unix epoch, the clock of LogRecord::timestamp().
+std::int64_t wallNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Sink rendering every record like the log file and writing it to /dev/null, standing in for the file in the null output.
+class NullSink : public KlyLogger::Sink {
+	const int file = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+	std::string buffer;
+
+public:
+	~NullSink() override { ::close(file); }
+
+	void write(const KlyLogger::LogRecord &record) override {
+		for (const std::string &line : record.plainLines()) {
+			buffer += line;
+			buffer += '\n';
+		}
+	}
+
+	void flush() override {
+		if (!buffer.empty() && ::write(file, buffer.data(), buffer.size()) < 0) {}
+		buffer.clear();
+	}
+
+	[[nodiscard]] size_t bufferedBytes() const override { return buffer.size(); }
+};
+
+// Sink measuring the time from the log call until the sinks before it have written the record, taken when it is flushed.
+class LatencySink : public KlyLogger::Sink {
+	std::vector<std::int64_t> pending;
+
+public:
+	std::vector<std::int64_t> latencies;
+
+	void write(const KlyLogger::LogRecord &record) override { pending.push_back(record.timestamp()); }
+
+	void flush() override {
+		const std::int64_t now = wallNanoseconds();
+		for (const std::int64_t timestamp : pending) latencies.push_back(now - timestamp);
+		pending.clear();
+	}
+};
+
+// Sink holding up the logging thread until it is opened, to build a backlog.
+class GateSink : public KlyLogger::Sink {
+public:
+	std::atomic_bool open{false}, entered{false};
+
+	void write(const KlyLogger::LogRecord &) override {
+		entered = true;
+		while (!open) std::this_thread::sleep_for(1ms);
+	}
+};
+
+// Log an INFO record with `count` arguments of mixed types.
+void logWithArguments(const KlyLogger &logger, size_t count, int i) {
+	static const std::string text = "narrow string";
+	static const std::wstring wide = L"wide string";
+	switch (count) {
+		case 0: return logger.info("request done");
+		case 1: return logger.info("request {} done", i);
+		case 2: return logger.info("request {} from {} done", i, text);
+		case 3: return logger.info("request {} from {} ({}) done", i, text, wide);
+		case 4: return logger.info("request {} from {} ({}) done in {} ms", i, text, wide, i * 0.25);
+		case 5: return logger.info(L"request {} from {} ({}) done in {} ms, status {}", i, text, wide, i * 0.25, 200u);
+		case 6: return logger.info(L"request {} from {} ({}) done in {} ms, status {}, {} bytes", i, text, wide, i * 0.25, 200u, 4096ull);
+		case 7: return logger.info("request {} from {} ({}) done in {} ms, status {}, {} bytes, cached {}", i, text, wide, i * 0.25, 200u, 4096ull, true);
+		default: return logger.info("request {} from {} ({}) done in {} ms, status {}, {} bytes, cached {}, {}", i, text, wide, i * 0.25, 200u, 4096ull, true, 'x');
+	}
+}
+
+// Caller-side latency of info() with 0 to 8 arguments.
+void runLatency(const KlyLogger &logger, size_t records) {
+	std::vector<std::int64_t> samples(records);
+	for (size_t count = 0; count <= 8; count++) {
+		for (size_t i = 0; i < records; i++) {
+			const auto start = Clock::now();
+			logWithArguments(logger, count, static_cast<int>(i));
+			samples[i] = (Clock::now() - start).count();
+		}
+		KlyLogger::wait();
+		std::sort(samples.begin(), samples.end());
+		report(std::format("info() {} args p50/p99/p99.9 ns", count).c_str(), "{} / {} / {}", percentile(samples, 0.5), percentile(samples, 0.99), percentile(samples, 0.999));
+	}
+}
+
+// Records per second written by 1 to 64 producer threads, until wait() returns.
+void runThroughput(const KlyLogger &logger, size_t records) {
+	for (size_t threads = 1; threads <= 64; threads *= 2) {
+		const size_t perThread = std::max<size_t>(records / threads, 1);
+		std::barrier start(static_cast<std::ptrdiff_t>(threads + 1));
+		std::vector<std::thread> producers;
+		for (size_t t = 0; t < threads; t++) {
+			producers.emplace_back([&logger, &start, perThread, t] {
+				start.arrive_and_wait();
+				for (size_t i = 0; i < perThread; i++) logger.info("worker {} record {} value {}", t, i, i * 0.5);
+			});
+		}
+		start.arrive_and_wait();
+		const auto begin = Clock::now();
+		for (std::thread &producer : producers) producer.join();
+		KlyLogger::wait();
+		const std::chrono::duration<double> elapsed = Clock::now() - begin;
+		report(std::format("{} producer threads", threads).c_str(), "{:.0f} records/s", static_cast<double>(perThread * threads) / elapsed.count());
+	}
+}
+
+// Time from the log call until the output sinks have written the record, at a moderate steady rate.
+void runEndToEnd(const KlyLogger &logger, size_t records) {
+	const auto sink = std::make_shared<LatencySink>();
+	sink->latencies.reserve(records);
+	KlyLogger::addSink(sink);
+	for (size_t i = 0; i < records; i++) {
+		logger.info("request {} done in {} ms", i, i * 0.25);
+		if (i % 64 == 63) std::this_thread::sleep_for(50us);
+	}
+	KlyLogger::wait();
+	KlyLogger::removeSink(sink);
+	KlyLogger::wait();
+
+	std::vector<std::int64_t> &samples = sink->latencies;
+	std::sort(samples.begin(), samples.end());
+	report("enqueue to write p50/p99/p99.9 us", "{:.1f} / {:.1f} / {:.1f}", percentile(samples, 0.5) / 1e3, percentile(samples, 0.99) / 1e3, percentile(samples, 0.999) / 1e3);
+	report("enqueue to write max us", "{:.1f}", samples.empty() ? 0.0 : static_cast<double>(samples.back()) / 1e3);
+}
+
+// Memory held while the logging thread is stalled and the queue is full, and after the backlog is written.
+void runBacklog(const KlyLogger &logger, size_t records) {
+	const std::string payload(200, 'p');
+	const auto gate = std::make_shared<GateSink>();
+	KlyLogger::addSink(gate);
+	KlyLogger::wait();
+	const long before = residentKiB();
+
+	KlyLogger::setOverflowPolicy(KlyLogger::OverflowPolicy::DropNewest);
+	const size_t droppedBefore = KlyLogger::droppedRecordCount();
+	logger.info("stall");
+	while (!gate->entered) std::this_thread::sleep_for(1ms);
+	for (size_t i = 0; i < records; i++) logger.info("backlog {} {}", i, payload);
+	const long stalled = residentKiB();
+	const size_t dropped = KlyLogger::droppedRecordCount() - droppedBefore;
+
+	gate->open = true;
+	KlyLogger::wait();
+	KlyLogger::removeSink(gate);
+	KlyLogger::setOverflowPolicy(KlyLogger::OverflowPolicy::Block);
+	KlyLogger::wait();
+	const long drained = residentKiB();
+
+	report("resident growth with full queue", "{} KiB ({} of {} records dropped)", stalled - before, dropped, records);
+	report("resident growth after draining", "{} KiB", drained - before);
+}
+
+// Throughput of long multi-line messages full of color codes.
+void runLarge(const KlyLogger &logger, size_t records) {
+	std::string message;
+	for (int line = 0; line < 16; line++) {
+		if (line) message += '\n';
+		for (int word = 0; word < 10; word++) message += std::format("\302\247{}word{:02} ", "0123456789abcdef"[(line + word) % 16], word);
+	}
+	const size_t count = std::max<size_t>(records / 10, 1);
+	const auto begin = Clock::now();
+	for (size_t i = 0; i < count; i++) logger.info("{} {}", i, message);
+	KlyLogger::wait();
+	const std::chrono::duration<double> elapsed = Clock::now() - begin;
+	report("16-line colored messages", "{:.0f} records/s, {:.1f} MiB/s of message text", static_cast<double>(count) / elapsed.count(),
+			static_cast<double>(count * message.size()) / elapsed.count() / (1 << 20));
+}
+
+// Time per byte of colored multi-line messages from 1 KiB to 4 MiB, writing about the same amount of text at each size.
+void runSizes(const KlyLogger &logger, size_t records) {
+	std::string line;
+	for (int word = 0; word < 10; word++) line += std::format("\302\247{}word{:02} ", "0123456789abcdef"[word % 16], word);
+	for (size_t size = 1 << 10; size <= 4 << 20; size *= 4) {
+		std::string message;
+		message.reserve(size);
+		while (message.size() + line.size() + 1 <= size) message.append(line).push_back('\n');
+		message.append(size - message.size(), 'x');
+		const size_t count = std::clamp<size_t>((16 << 20) / size, 1, records);
+		const auto begin = Clock::now();
+		for (size_t i = 0; i < count; i++) logger.info("{} {}", i, message);
+		KlyLogger::wait();
+		const std::chrono::duration<double, std::nano> elapsed = Clock::now() - begin;
+		const double bytes = static_cast<double>(count * size);
+		report(std::format("{} KiB messages", size >> 10).c_str(), "{:.2f} ns/byte, {:.1f} MiB/s ({} records)", elapsed.count() / bytes,
+				bytes / (elapsed.count() / 1e9) / (1 << 20), count);
+	}
+}
+
+// Heap allocations per log call on the calling thread once logging has warmed up, which should be zero. The formats are
+// marked with literal(), deferred formatting copies any other format.
+// Returns false if any call allocated, so allocation regressions fail the run.
+bool runAllocations(const KlyLogger &logger, size_t records) {
+	bool allocationFree = true;
+	const std::string path(300, 'p'), page(4000, 'x');
+	const std::wstring user = L"wide user";
+	const auto measure = [&](const char *metric, const auto &call) {
+		// Warm up with a full queue, so the message pool holds as many blocks as can be in flight.
+		const size_t warmup = std::max<size_t>(records, 2 * KLY_LOGGER_OPTION_QUEUE_CAPACITY);
+		for (size_t i = 0; i < warmup; i++) call(i);
+		KlyLogger::wait();
+		const size_t before = allocations;
+		for (size_t i = 0; i < records; i++) call(i);
+		const size_t counted = allocations - before;
+		KlyLogger::wait();
+		report(metric, "{:.4f} allocations/call{}", static_cast<double>(counted) / static_cast<double>(records), counted ? " (expected 0)" : "");
+		if (counted) allocationFree = false;
+	};
+
+	measure("info() int and double", [&](size_t i) { logger.info(KlyLogger::literal("request {} done in {} ms"), i, i * 0.25); });
+	measure("info() 300-byte string", [&](size_t i) { logger.info(KlyLogger::literal("request {} for {}"), i, path); });
+	measure("info() 4000-byte string", [&](size_t i) { logger.info(KlyLogger::literal("request {} for {}"), i, page); });
+	measure("infoEvery(4) int", [&](size_t i) { logger.infoEvery(4, KlyLogger::literal("request {} done"), i); });
+	measure("info() wide string", [&](size_t i) { logger.info(KlyLogger::literal("request {} by {}"), i, user); });
+	measure("info() kv() fields", [&](size_t i) { logger.info(KlyLogger::literal("request done"), KlyLogger::kv("id", i), KlyLogger::kv("ms", i * 0.25), KlyLogger::kv("path", path)); });
+	return allocationFree;
+}
+
+// Body of a child process: set up the output, then run the cases. Fails if a case found a regression.
+int runChild(const char *output, const std::string &benchCase, size_t records) {
+	currentOutput = output;
+	if (std::string_view(output) != "tmpfs") KlyLogger::removeSink(KlyLogger::fileSink());
+	if (std::string_view(output) == "null") KlyLogger::addSink(std::make_shared<NullSink>());
+	KlyLogger::wait();
+
+	const KlyLogger logger("Bench");
+	int status = 0;
+	for (const char *name : CASES) {
+		if (benchCase != "all" && benchCase != name) continue;
+		currentCase = name;
+		const std::string_view selected = name;
+		if (selected == "latency") runLatency(logger, records);
+		else if (selected == "throughput") runThroughput(logger, records);
+		else if (selected == "e2e") runEndToEnd(logger, records);
+		else if (selected == "backlog") runBacklog(logger, records);
+		else if (selected == "large") runLarge(logger, records);
+		else if (selected == "sizes") runSizes(logger, records);
+		else if (!runAllocations(logger, records)) status = 1;
+	}
+	return status;
+}
+
+// Run the benchmark executable with stderr connected to `console`.
+bool spawn(const std::filesystem::path &executable, const char *output, const std::string &benchCase, size_t records, int console) {
+	const std::string count = std::to_string(records);
+	const pid_t pid = fork();
+	if (pid < 0) return false;
+	if (!pid) {
+		dup2(console, STDERR_FILENO);
+		execl(executable.c_str(), executable.c_str(), "--child", output, benchCase.c_str(), count.c_str(), static_cast<char *>(nullptr));
+		_exit(127);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Run one output in a child process.
+bool runOutput(const std::filesystem::path &self, const char *output, const std::string &benchCase, size_t records) {
+	const std::string_view name = output;
+	if (name == "pty") {
+		const int master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (master < 0 || grantpt(master) || unlockpt(master)) return false;
+		const int terminal = ::open(ptsname(master), O_RDWR | O_NOCTTY);
+		if (terminal < 0) return false;
+		// Drain the terminal like a fast terminal emulator would, until the child has exited and closed it.
+		std::thread reader([master] {
+			char buffer[65536];
+			while (::read(master, buffer, sizeof(buffer)) > 0) {}
+		});
+		const bool success = spawn(self, output, benchCase, records, terminal);
+		::close(terminal);
+		reader.join();
+		::close(master);
+		return success;
+	}
+
+	const int null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+	bool success;
+	if (name == "tmpfs") {
+		// The log file is written next to the executable, so run a copy of it from tmpfs.
+		std::error_code error;
+		const std::filesystem::path directory = std::filesystem::path("/dev/shm") / std::format("klylogger-bench-{}", getpid());
+		std::filesystem::create_directories(directory, error);
+		std::filesystem::copy_file(self, directory / self.filename(), std::filesystem::copy_options::overwrite_existing, error);
+		success = !error && spawn(directory / self.filename(), output, benchCase, records, null);
+		std::filesystem::remove_all(directory, error);
+	} else success = spawn(self, output, benchCase, records, null);
+	::close(null);
+	return success;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc == 5 && std::string_view(argv[1]) == "--child") return runChild(argv[2], argv[3], std::strtoull(argv[4], nullptr, 10));
+
+	std::string output = "all", benchCase = "all";
+	size_t records = 100000;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const std::string_view option = argv[i];
+		if (option == "--output") output = argv[i + 1];
+		else if (option == "--case") benchCase = argv[i + 1];
+		else if (option == "--records") records = std::max<size_t>(std::strtoull(argv[i + 1], nullptr, 10), 1);
+		else {
+			std::fprintf(stderr, "usage: %s [--output null|tmpfs|pty|all] [--case latency|throughput|e2e|backlog|large|sizes|alloc|all] [--records N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	const std::filesystem::path self = std::filesystem::read_symlink("/proc/self/exe");
+	std::printf("%-6s %-11s %-34s %s\n", "output", "case", "metric", "result");
+	std::fflush(stdout);
+	int status = 0;
+	for (const char *name : OUTPUTS) {
+		if (output != "all" && output != name) continue;
+		if (!runOutput(self, name, benchCase, records)) {
+			std::fprintf(stderr, "klylogger_bench: the %s output failed\n", name);
+			status = 1;
+		}
+	}
+	return status;
+}
@@ -0,0 +1,30 @@
+// klylog-decode: convert binary log files written with KLY_LOGGER_OPTION_BINARY_LOG_FILE back into the text of latest.log.
+// Usage: klylog-decode [FILE.klog]...
+// Reads standard input if no file is given. Compressed backups can be piped in, e.g. zcat 2025-01-01-1.klog.gz | klylog-decode
+
+#define KLY_LOGGER_OPTION_NO_LOG_FILE
+#define KLY_LOGGER_OPTION_NO_FLIGHT_RECORDER
+#include "../KlyLogger.hpp"
+
+int main(int argc, char **argv) {
+	std::ios::sync_with_stdio(false);
+	if (argc < 2) {
+		if (KlyLogger::BinaryLog::decode(std::cin, std::cout)) return 0;
+		std::cerr << "klylog-decode: standard input is not a complete binary log file" << std::endl;
+		return 1;
+	}
+
+	int status = 0;
+	for (int i = 1; i < argc; i++) {
+		std::ifstream file(argv[i], std::ios::binary);
+		if (!file) {
+			std::cerr << "klylog-decode: cannot open " << argv[i] << std::endl;
+			status = 1;
+		} else if (!KlyLogger::BinaryLog::decode(file, std::cout)) {
+			std::cerr << "klylog-decode: " << argv[i] << " is not a complete binary log file" << std::endl;
+			status = 1;
+		}
+	}
+	std::cout.flush();
+	return status;
+}